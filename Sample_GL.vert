@@ -1,22 +1,38 @@
 #version 330 core
 
 // input data : sent from main program
-layout (location = 0) in vec3 vertexPosition;
-layout (location = 1) in vec3 vertexColor;
+layout (location = 0) in vec3 vertexPosition; // in units of positionUnit
+layout (location = 1) in uint vertexColor; // index into palette
 
-uniform mat4 MVP;
+// per instance: where the mesh goes, and whether it is drawn
+layout (location = 2) in vec3 instanceOffset;
+layout (location = 3) in uint instanceFlags; // 0 = hidden, 1 = at instanceOffset, 2 = by the cuboid matrix
+
+// per frame, written into a ring buffer by the program
+layout (std140) uniform Frame {
+    mat4 VP;
+    mat4 cuboid;
+};
+
+uniform float positionUnit;
+uniform vec3 palette[16]; // face colors of every mesh
 
 // output data : used by fragment shader
 out vec3 fragColor;
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    vec4 v = vec4(vertexPosition*positionUnit, 1); // Transform an homogeneous 4D vector
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
-    fragColor = vertexColor;
+    fragColor = palette[vertexColor];
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Output position of the vertex, in clip space : VP * M * position
+    if (instanceFlags == 2u)
+        gl_Position = VP * cuboid * v;
+    else if (instanceFlags == 1u)
+        gl_Position = VP * vec4(v.xyz + instanceOffset, 1);
+    else
+        gl_Position = vec4(0, 0, 2, 1); // beyond the far plane: hidden instances are clipped
 }
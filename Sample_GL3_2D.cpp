@@ -2,6 +2,27 @@
 #include <cmath>
 #include <fstream>
 #include <vector>
+#include <string>
+#include <cctype>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -11,28 +32,85 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "solver.h"
+#include "levels.h"
+#include "levelfile.h"
+#include "jobs.h"
+#include "stats.h"
+#include "sessionlog.h"
+#include "zobrist.h"
+
 using namespace std;
 
-struct VAO {
-	GLuint VertexArrayID;
-	GLuint VertexBuffer;
-	GLuint ColorBuffer;
+/* Meshes are stored as 4 bytes per vertex: a position in whole multiples of
+   position_unit and an index into a palette of face colors, which the vertex
+   shader looks up. */
+struct packed_vertex {
+	signed char x, y, z;
+	unsigned char color; // index into palette
+};
 
-	GLenum PrimitiveMode;
-	GLenum FillMode;
-	int NumVertices;
+struct mesh_slot {
+	vector<packed_vertex> Vertices; // copied into the shared scene buffers
 };
-typedef struct VAO VAO;
+
+/* Meshes are created once at start up, whatever the level, and referred to
+   by handle. They own no GL objects: create_scene_buffers packs every slot
+   into one buffer. */
+typedef int mesh; // index into mesh_pool, -1 = none
+vector<mesh_slot> mesh_pool;
+
+constexpr float side = 1; // edge of a tile and width of the cuboid
+constexpr float position_unit = side/50; // every mesh corner is a multiple of it
+constexpr float max_mesh_extent = side; // farthest any mesh corner is from its center: the cuboid's ends
+static_assert(max_mesh_extent/position_unit <= 127, "mesh corners fit a signed char of position units");
+const int max_palette = 16; // size of the palette array in Sample_GL.vert
+vector<glm::vec3> palette;
+
+// v in whole position units; corners past what a signed char holds are clamped
+signed char pack_coordinate (GLfloat v)
+{
+	long units = lround(v / position_unit);
+	if (units < -127 || units > 127)
+	{
+		cerr << "mesh coordinate " << v << " out of range, clamped to " << (units < 0 ? -127 : 127)*position_unit << endl;
+		units = min(max(units, -127L), 127L);
+	}
+	return units;
+}
+
+// index of a color in the palette, added if new
+unsigned char palette_index (GLfloat red, GLfloat green, GLfloat blue)
+{
+	for (int k = 0; k < palette.size(); k++)
+		if (palette[k][0] == red && palette[k][1] == green && palette[k][2] == blue)
+			return k;
+	if (palette.size() == max_palette) {
+		cerr << "palette full, color (" << red << ", " << green << ", " << blue << ") dropped" << endl;
+		return 0;
+	}
+	palette.push_back(glm::vec3(red, green, blue));
+	return palette.size() - 1;
+}
 
 struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
 	glm::mat4 view;
-	GLuint MatrixID;
 } Matrices;
 
 GLuint programID;
 
+job_system jobs; // background work: hint tables and level decoding
+stats_service stats; // attempts per level, logged and served off the game thread
+session_writer session; // keys and results of this session, compressed
+double session_start;
+
+void log_event(int kind, unsigned value = 0)
+{
+	session.add(kind, (glfwGetTime() - session_start)*60, value);
+}
+
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
 
@@ -110,129 +188,389 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	return ProgramID;
 }
 
+/* Ring of buffer regions for per-frame dynamic data (matrices, draw flags
+   and indirect commands). With GL 4.4 / ARB_buffer_storage the ring is
+   mapped once, persistent and coherent, and a fence per region keeps the CPU
+   from overwriting data the GPU has not consumed yet. Otherwise the buffer is
+   orphaned and mapped again every frame. Either way the data is written
+   straight into the mapping. */
+class frame_ring {
+	public:
+		static const int regions = 3; // frames in flight
+		GLuint buffer;
+		bool persistent;
+		GLsizeiptr region_size; // bytes of one frame
+		GLint alignment; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+		char *mapped; // whole ring when persistent, the current frame otherwise
+		GLsync fences[regions];
+		int region;
+		GLintptr base, used; // offset of the current region, bytes handed out in it
+
+		frame_ring()
+		{
+			buffer = 0;
+			persistent = false;
+			region_size = 0;
+			alignment = 256;
+			mapped = NULL;
+			region = 0;
+			base = used = 0;
+			for (int k = 0; k < regions; k++)
+				fences[k] = 0;
+		}
+
+		void create(GLsizeiptr size)
+		{
+			persistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			region_size = (size + alignment - 1) / alignment * alignment;
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			if (persistent)
+			{
+				GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				glBufferStorage(GL_UNIFORM_BUFFER, regions*region_size, NULL, flags);
+				mapped = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, regions*region_size, flags);
+			}
+			else
+				glBufferData(GL_UNIFORM_BUFFER, region_size, NULL, GL_STREAM_DRAW);
+		}
+
+		void destroy()
+		{
+			for (int k = 0; k < regions; k++)
+				if (fences[k])
+				{
+					glDeleteSync(fences[k]);
+					fences[k] = 0;
+				}
+			if (persistent && mapped)
+			{
+				glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+				glUnmapBuffer(GL_UNIFORM_BUFFER);
+			}
+			glDeleteBuffers(1, &buffer);
+			buffer = 0;
+			mapped = NULL;
+		}
+
+		// start writing a frame that needs up to size bytes
+		void begin_frame(GLsizeiptr size)
+		{
+			if (size > region_size) // grow: the GPU must be done with the old ring first
+			{
+				glFinish();
+				destroy();
+				create(max(size, 2*region_size));
+			}
+			used = 0;
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			if (persistent)
+			{
+				region = (region + 1) % regions;
+				base = region*region_size;
+				if (fences[region])
+				{
+					while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+						;
+					glDeleteSync(fences[region]);
+					fences[region] = 0;
+				}
+			}
+			else
+			{
+				base = 0;
+				glBufferData(GL_UNIFORM_BUFFER, region_size, NULL, GL_STREAM_DRAW); // orphan
+				mapped = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, region_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			}
+		}
+
+		// room for size bytes in this frame; returns its offset in the buffer
+		GLintptr alloc(GLsizeiptr size, void **data)
+		{
+			GLintptr offset = base + used;
+			*data = mapped + (persistent ? offset : used);
+			used += aligned(size);
+			return offset;
+		}
+
+		// every write of the frame is done, draws may follow
+		void flush()
+		{
+			if (!persistent)
+			{
+				glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+				glUnmapBuffer(GL_UNIFORM_BUFFER);
+				mapped = NULL;
+			}
+		}
+
+		// every draw reading the frame has been issued
+		void end_frame()
+		{
+			if (persistent)
+				fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+
+		// bytes alloc() takes out of the frame for size bytes
+		GLsizeiptr aligned(GLsizeiptr size) const
+		{
+			return (size + alignment - 1) / alignment * alignment;
+		}
+};
+frame_ring uniforms;
+const GLuint frame_block = 0; // binding point of the Frame uniform block
+
+/* Uniform block binding, scale and colors of the packed vertices */
+void setup_program (GLuint program)
+{
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Frame"), frame_block);
+	glUseProgram(program);
+	glUniform1f(glGetUniformLocation(program, "positionUnit"), position_unit);
+	glUniform3fv(glGetUniformLocation(program, "palette"), palette.size(), &palette[0][0]);
+}
+
+atomic<bool> shaders_changed(false); // set by the file watcher, handled by render()
+
+/* Relink the program from the edited shader files. If they do not link, the
+   running program is kept. */
+void reload_shaders ()
+{
+	GLuint program = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		glDeleteProgram(program);
+		cerr << "Shaders not reloaded, keeping the previous program" << endl;
+		return;
+	}
+	glDeleteProgram(programID);
+	programID = program;
+	setup_program(programID);
+	cout << "Shaders reloaded" << endl;
+}
+
 static void error_callback(int error, const char* description)
 {
 	fprintf(stderr, "Error: %s\n", description);
 }
 
+void destroy_scene_buffers();
+
+void stop_render_thread (GLFWwindow* window);
+void report_latency ();
+void stop_hot_reload ();
+void stop_stats ();
+
 void quit(GLFWwindow *window)
 {
+	stop_render_thread(window);
+	report_latency();
+	job_metrics m = jobs.metrics();
+	if (m.submitted > 0)
+		cout << "Jobs: " << m.executed << " run on " << jobs.size() << " workers, " << m.steals << " stolen, queue depth " << m.queue_depth << " (max " << m.max_queue_depth << ")" << endl;
+	jobs.stop();
+	stop_hot_reload();
+	stop_stats();
+	session.close();
+	destroy_scene_buffers();
+	uniforms.destroy();
+	glDeleteProgram(programID);
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
 }
 
-
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* Pack the triangles of a mesh into a new slot and return its handle */
+mesh create3DObject (int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data)
 {
-	struct VAO* vao = new struct VAO;
-	vao->PrimitiveMode = primitive_mode;
-	vao->NumVertices = numVertices;
-	vao->FillMode = fill_mode;
-
-	// Create Vertex Array Object
-	// Should be done after CreateWindow and before any other GL calls
-	glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-	glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-	glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-	glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-	glVertexAttribPointer(
-						  0,                  // attribute 0. Vertices
-						  3,                  // size (x,y,z)
-						  GL_FLOAT,           // type
-						  GL_FALSE,           // normalized?
-						  0,                  // stride
-						  (void*)0            // array buffer offset
-						  );
-
-	glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-	glVertexAttribPointer(
-						  1,                  // attribute 1. Color
-						  3,                  // size (r,g,b)
-						  GL_FLOAT,           // type
-						  GL_FALSE,           // normalized?
-						  0,                  // stride
-						  (void*)0            // array buffer offset
-						  );
-
-	return vao;
+	mesh m = mesh_pool.size();
+	mesh_pool.push_back(mesh_slot());
+
+	// Pack the vertices
+	vector<packed_vertex> &vertices = mesh_pool[m].Vertices;
+	vertices.resize(numVertices);
+	for (int i=0; i<numVertices; i++) {
+		vertices[i].x = pack_coordinate(vertex_buffer_data[3*i]);
+		vertices[i].y = pack_coordinate(vertex_buffer_data[3*i + 1]);
+		vertices[i].z = pack_coordinate(vertex_buffer_data[3*i + 2]);
+		vertices[i].color = palette_index(color_buffer_data[3*i], color_buffer_data[3*i + 1], color_buffer_data[3*i + 2]);
+	}
+
+	return m;
 }
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+/* Pack the triangles of a mesh into a new slot and return its handle - Common Color for all vertices */
+mesh create3DObject (int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue)
 {
-	GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+	vector<GLfloat> color_buffer_data (3*numVertices);
 	for (int i=0; i<numVertices; i++) {
 		color_buffer_data [3*i] = red;
 		color_buffer_data [3*i + 1] = green;
 		color_buffer_data [3*i + 2] = blue;
 	}
 
-	return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+	return create3DObject(numVertices, vertex_buffer_data, &color_buffer_data[0]);
 }
 
-/* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
-{
-	// Change the Fill Mode for this object
-	glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+/* Every mesh of the pool packed into one vertex and one index buffer behind
+   a single VAO, so a whole frame is one indirect multi-draw. Each mesh is a
+   range of the index buffer, drawn instanced over a per-instance offset
+   (attribute 2) and draw flag (attribute 3). */
+struct draw_command { // layout of DrawElementsIndirectCommand
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
 
-	// Bind the VAO to use
-	glBindVertexArray (vao->VertexArrayID);
+struct scene_buffers {
+	GLuint VertexArrayID;
+	GLuint VertexBuffer; // packed_vertex of every mesh, duplicates merged
+	GLuint IndexBuffer; // GLushort, relative to the base vertex of the mesh
+	GLuint OffsetBuffer; // glm::vec3 per instance, rebuilt when a level loads
+	vector<draw_command> ranges; // index range of every mesh, by handle
+	bool indirect; // glMultiDrawElementsIndirect honours baseInstance
+	int level_serial; // level the offsets were built for
+	unordered_map<unsigned, int> tile_at; // tile index by tile_key
+} scene;
+
+// key of a tile position, in half sides
+unsigned tile_key (int x, int z)
+{
+	return ((unsigned)x << 16) | (z & 0xffff);
+}
 
-	// Enable Vertex Attribute 0 - 3d Vertices
-	glEnableVertexAttribArray(0);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+// called once every mesh has been created
+void create_scene_buffers ()
+{
+	vector<packed_vertex> vertices;
+	vector<GLushort> indices;
+	scene.ranges.assign(mesh_pool.size(), draw_command());
+	for (int m = 0; m < mesh_pool.size(); m++) {
+		const vector<packed_vertex> &source = mesh_pool[m].Vertices;
+		draw_command &range = scene.ranges[m];
+		range.count = source.size();
+		range.instanceCount = 0;
+		range.firstIndex = indices.size();
+		range.baseVertex = vertices.size();
+		range.baseInstance = 0;
+		for (int v = 0; v < source.size(); v++) {
+			int k = range.baseVertex;
+			while (k < vertices.size() && memcmp(&vertices[k], &source[v], sizeof(packed_vertex)) != 0)
+				k++;
+			if (k == vertices.size())
+				vertices.push_back(source[v]);
+			indices.push_back(k - range.baseVertex);
+		}
+	}
 
-	// Enable Vertex Attribute 1 - Color
-	glEnableVertexAttribArray(1);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+	glGenVertexArrays(1, &scene.VertexArrayID);
+	glGenBuffers(1, &scene.VertexBuffer);
+	glGenBuffers(1, &scene.IndexBuffer);
+	glGenBuffers(1, &scene.OffsetBuffer);
+	glBindVertexArray(scene.VertexArrayID);
+
+	glBindBuffer(GL_ARRAY_BUFFER, scene.VertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(packed_vertex), &vertices[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_BYTE, GL_FALSE, sizeof(packed_vertex), (void*)0);
+	glVertexAttribIPointer(1, 1, GL_UNSIGNED_BYTE, sizeof(packed_vertex), (void*)offsetof(packed_vertex, color));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene.IndexBuffer); // part of the VAO state
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, scene.OffsetBuffer);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	glVertexAttribDivisor(2, 1);
+	glVertexAttribDivisor(3, 1); // pointed into the uniform ring every frame
+	for (int a = 0; a < 4; a++)
+		glEnableVertexAttribArray(a);
+	glBindVertexArray(0);
+
+	scene.indirect = GLAD_GL_VERSION_4_3 || (GLAD_GL_ARB_multi_draw_indirect && GLAD_GL_ARB_base_instance);
+	scene.level_serial = -1;
+}
 
-	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+void destroy_scene_buffers ()
+{
+	glDeleteBuffers(1, &scene.VertexBuffer);
+	glDeleteBuffers(1, &scene.IndexBuffer);
+	glDeleteBuffers(1, &scene.OffsetBuffer);
+	glDeleteVertexArrays(1, &scene.VertexArrayID);
 }
 
+
 /**************************
  * Customizable functions *
  **************************/
 
-float triangle_rot_dir = 1;
-float rectangle_rot_dir = 1;
-bool triangle_rot_status = true;
-bool rectangle_rot_status = true;
-
-const float side = 1;
 int game_progress; // -1 = lost; 0 = in progress, 1 = won
 bool take_action = false;
 int last_move = -1;
 
-class cuboid {
+/* Logical state of the cuboid on the integer lattice of half sides. Rule
+   checks compare these integers exactly; floats are only derived for
+   rendering. */
+struct lattice_pose {
+	short x, y, z; // position of center, in half sides
+	signed char state; // 0 = along x-axis, 1 = along y-axis, 2 = along z-axis
+	signed char rotation[3][3]; // accumulated quarter turns, row major
+};
+static_assert(sizeof(lattice_pose) == 16, "lattice_pose packs into 16 bytes");
+
+/* Zobrist hash of the game state: the cuboid, keyed as zobrist_pose keys
+   it, and every tile not shown. Each change updates it with an XOR or two;
+   it is only computed from scratch when a level is loaded, and checked
+   against that after every rule pass in builds without NDEBUG. The highlighted hint
+   steps are kept until it changes. */
+unsigned long long state_hash;
+
+unsigned long long hidden_key(int i, int j) // map matrix coordinates
+{
+	return zobrist(ZOBRIST_HIDDEN, i*max_map_size + j, 0);
+}
+
+void record_move();
+
+class cuboid : public lattice_pose {
 	public:
-		int state; // 0 = along x-axis, 1 = along y-axis, 2 = along z-axis
-		glm::mat4 rotation;
-		float x, y, z; // position of center
-		float one_x, one_y, one_z; //one and two refer to the centers of two cubes that make up the cuboid
-		float two_x, two_y, two_z;
 		int moves;
-		VAO *obj;
+		float fall; // distance fallen after the game ended, render only
+		mesh obj;
 
 		cuboid()
 		{
-			state = 1;
-			rotation = glm::mat4(1.0f);
-			x = y = z = one_x = one_z = two_x = two_z = 0;
-			one_y = -1*side/2;
-			two_y = side/2;
+			place(map_center_i, map_center_j);
 			moves = 0;
 		}
 
+		// one and two refer to the centers of two cubes that make up the cuboid, in half sides
+		int one_x() const { return state == 0 ? x - 1 : x; }
+		int one_z() const { return state == 2 ? z + 1 : z; }
+		int two_x() const { return state == 0 ? x + 1 : x; }
+		int two_z() const { return state == 2 ? z - 1 : z; }
+
+		// position of center for rendering
+		glm::vec3 position() const
+		{
+			return glm::vec3(x*side/2, y*side/2 + fall, z*side/2);
+		}
+
+		unsigned long long key() const
+		{
+			int i = one_x()/2 + map_center_i, j = map_center_j - one_z()/2;
+			return zobrist(ZOBRIST_POSE, i*max_map_size + j, state);
+		}
+
+		glm::mat4 rotation_matrix() const
+		{
+			glm::mat4 m(1.0f);
+			for (int row = 0; row < 3; row++)
+				for (int col = 0; col < 3; col++)
+					m[col][row] = rotation[row][col];
+			return m;
+		}
+
 		void create()
 		{
 			static const GLfloat vertex_buffer_data [] = {
@@ -342,277 +680,569 @@ class cuboid {
 				1,1,1,
 			};
 
-			// create3DObject creates and returns a handle to a VAO that can be used later
-			obj = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, color_buffer_data, GL_FILL);
+			// create3DObject packs the triangles and returns a handle to the mesh
+			obj = create3DObject(12*3, vertex_buffer_data, color_buffer_data);
 		}
 
-		void move(int dir) // 0=Left, 1=Right, 2=Up, 3=Down
+		// stand the cuboid upright on map cell (i, j)
+		void place(int i, int j)
+		{
+			x = 2*(i - map_center_i);
+			y = 0;
+			z = -2*(j - map_center_j);
+			for (int row = 0; row < 3; row++)
+				for (int col = 0; col < 3; col++)
+					rotation[row][col] = (row == col);
+			state = 1;
+			fall = 0;
+		}
+
+		// 0=Left, 1=Right, 2=Up, 3=Down; record = can be undone. false when the game has ended and the cuboid stays put
+		bool move(int dir, bool record = true)
 		{
 			last_move = dir;
 			if(game_progress != 0)
-				return;
+				return false;
+			if(record)
+				record_move();
 			moves++;
-			if (dir == 0) // LEFT
-			{
-				rotation = glm::rotate((float)(90*M_PI/180.0f), glm::vec3(0,0,1)) * rotation;
-				if (state == 0) // along x
-				{
-					state = 1;
-					x -= (side + side/2);
-					y += side/2;
-				}
-				else if (state == 1)
-				{
-					state = 0;
-					x -= (side + side/2);
-					y -= side/2;
-				}
-				else if (state == 2)
-				{
-					x -= side;
-				}
-			}
-			else if (dir == 1) // RIGHT
-			{
-				rotation = glm::rotate((float)(-90*M_PI/180.0f), glm::vec3(0,0,1)) * rotation;
-				if (state == 0)
-				{
-					state = 1;
-					x += (side + side/2);
-					y += side/2;
-				}
-				else if (state == 1)
-				{
-					state = 0;
-					x += (side + side/2);
-					y -= side/2;
-				}
-				else if (state == 2)
-				{
-					x += side;
-				}
-			}
-			else if (dir == 2) // UP
-			{
-				rotation = glm::rotate((float)(-90*M_PI/180.0f), glm::vec3(1,0,0)) * rotation;
-				if (state == 0)
-				{
-					z -= side;
-				}
-				else if (state == 1)
-				{
-					state = 2;
-					z -= (side + side/2);
-					y -= side/2;
-				}
-				else if (state == 2)
-				{
-					state = 1;
-					z -= (side + side/2);
-					y += side/2;
-				}
-			}
-			else if (dir == 3) // DOWN
-			{
-				rotation = glm::rotate((float)(90*M_PI/180.0f), glm::vec3(1,0,0)) * rotation;
-				if (state == 0)
-				{
-					z += side;
-				}
-				else if (state == 1)
-				{
-					state = 2;
-					z += (side + side/2);
-					y -= side/2;
-				}
-				else if (state == 2)
-				{
-					state = 1;
-					z += (side + side/2);
-					y += side/2;
-				}
-			}
 
-			if (state == 0) // along x
-			{
-				one_x = x - side/2;
-				two_x = x + side/2;
+			// one entry of the shared transition table: no branching on (dir, state), no trig
+			const transition &t = transitions[dir][state];
+			signed char turned[3][3];
+			for (int row = 0; row < 3; row++)
+				for (int col = 0; col < 3; col++)
+					turned[row][col] = t.rotation[row][0]*rotation[0][col] + t.rotation[row][1]*rotation[1][col] + t.rotation[row][2]*rotation[2][col];
+			memcpy(rotation, turned, sizeof(turned));
+			state_hash ^= key();
+			state = t.state;
+			x += t.dx;
+			y += t.dy;
+			z += t.dz;
+			state_hash ^= key();
+			// cout << cuboidState << endl;
+			return true;
+		}
+};
+cuboid piece;
 
-				one_y = two_y = y;
+int mapInd = 0;
+vector<level_def> levels; // from the level pack, or the built-in levels
 
-				one_z = two_z = z;
-			}
-			else if (state == 1) // along y
-			{
-				one_x = two_x = x;
+/* Tiles of the level as a structure of arrays, so the rule pass and the
+   render pass each stream only the fields they need */
+class tile_store {
+	public:
+		vector<signed char> type; // 1 = regular, 2 = fragile, 3 = bridge, 4 = switch, 5 = goal
+		vector<unsigned char> show;
+		vector<unsigned char> state; //  0 = vacant, 1 = occupied, as of the last frame
+		vector<unsigned char> occupied; // rule pass scratch: bit 0 = cube one, bit 1 = cube two
+		vector<short> x, z; // position of center, in half sides
+		vector<short> i, j; // map matrix coordinates
+
+		int size() const
+		{
+			return type.size();
+		}
 
-				one_y = y + side/2;
-				two_y = y - side/2;
+		void add(int a, int b, int c) // map matrix coordinates, type
+		{
+			type.push_back(c);
+			show.push_back(c != 3);
+			state.push_back(0);
+			occupied.push_back(0);
+			x.push_back(2*(a - map_center_i));
+			z.push_back(-2*(b - map_center_j));
+			i.push_back(a);
+			j.push_back(b);
+		}
 
-				one_z = two_z = z;
-			}
-			else if (state == 2) // along z
-			{
-				one_x = two_x = x;
+		void reserve(int n)
+		{
+			type.reserve(n); show.reserve(n); state.reserve(n); occupied.reserve(n);
+			x.reserve(n); z.reserve(n); i.reserve(n); j.reserve(n);
+		}
 
-				one_y = two_y = y;
+		void clear()
+		{
+			type.clear(); show.clear(); state.clear(); occupied.clear();
+			x.clear(); z.clear(); i.clear(); j.clear();
+		}
 
-				one_z = z + side/2;
-				two_z = z - side/2;
-			}
-			// cout << cuboidState << endl;
+		void swap(tile_store &other)
+		{
+			type.swap(other.type); show.swap(other.show); state.swap(other.state); occupied.swap(other.occupied);
+			x.swap(other.x); z.swap(other.z); i.swap(other.i); j.swap(other.j);
 		}
 };
-cuboid piece;
+tile_store grid;
 
-int mapInd = 0;
-const int map_center_i = 5;
-const int map_center_j = 5;
-const int max_map_size = 10;
-const int max_maps = 2;
-
-// -1 indicates where the brick starts
-const int maps[max_maps][max_map_size][max_map_size] =
+// state_hash from scratch
+unsigned long long hash_state()
 {
-	{
-		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{ 0, 0, 0, 0, 0, 0, 1, 1, 1, 1},
-		{ 1, 1, 1, 1, 0, 0, 1, 1, 5, 1},
-		{ 1, 1, 4, 1, 0, 0, 1, 1, 1, 1},
-		{ 1, 1, 1, 1, 0, 0, 1, 1, 1, 1},
-		{ 1,-1, 1, 1, 3, 3, 1, 1, 1, 1},
-		{ 1, 1, 1, 1, 0, 0, 1, 1, 1, 1},
-		{ 2, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-	},
-	{
-		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{ 0, 0, 0, 0, 0, 0, 1, 1, 1, 1},
-		{ 1, 1, 1, 1, 0, 0, 1, 1, 5, 1},
-		{ 1, 1, 4, 1, 0, 0, 1, 1, 1, 1},
-		{ 1, 1, 1, 1, 0, 0, 1, 1, 1, 1},
-		{ 1,-1, 1, 1, 3, 3, 1, 1, 1, 1},
-		{ 1, 1, 1, 1, 0, 0, 1, 1, 1, 1},
-		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-	},
-};
+	unsigned long long h = piece.key();
+	for(int k = 0; k < grid.size(); k++)
+		if(!grid.show[k])
+			h ^= hidden_key(grid.i[k], grid.j[k]);
+	return h;
+}
 
-// first two numbers indicate switch indices; the rest pairwise tell the bridge indices
-const int max_switches = 2;
-const int max_switch_size = 10;
-const int switches[max_maps][max_switches][max_switch_size] =
-{
-	{
-		{ 4, 2, 6, 4, 6, 5,-1,-1,-1,-1},
-		{-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	},
-	{
-		{ 4, 2, 6, 4, 6, 5,-1,-1,-1,-1},
-		{-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
-	},
+const int max_snapshot_tiles = 128; // larger grids are played without undo
+
+/* The game between moves, packed into one cache line */
+struct game_snapshot {
+	lattice_pose pose;
+	int moves;
+	unsigned long long hash; // state_hash
+	unsigned long long show[max_snapshot_tiles/64], state[max_snapshot_tiles/64]; // bit k = tile k
 };
+static_assert(sizeof(game_snapshot) == 64, "game_snapshot fills a cache line");
 
-class tiles {
+/* Undo and redo: a snapshot before every move, in a ring of fixed depth
+   allocated once, so the oldest moves are forgotten rather than memory
+   growing. Snapshots past current are the moves undone, until the next
+   move drops them. */
+class undo_ring {
 	public:
-		int state; //  0 = vacant, 1 = occupied
-		int type; // 1 = regular, 2 = fragile, 3 = bridge, 4 = switch, 5 = goal
-		int i, j;
-		float x, y, z;
-		int show;
+		undo_ring()
+		{
+			clear();
+		}
+
+		void configure(int depth)
+		{
+			slots.assign(depth + 1, game_snapshot()); // + 1 for the state undone from
+			clear();
+		}
 
-		tiles(int a, int b, int c) // map matrix coordinates, type
+		void clear()
 		{
-			i = a;
-			j = b;
+			first = count = current = 0;
+		}
 
-			x = (i - map_center_i)*side;
-			y = -1*(side + side/10);
-			z = -1*(j - map_center_j)*side;
+		// s = the state a move leaves
+		void push(const game_snapshot &s)
+		{
+			if (slots.empty())
+				return;
+			at(current++) = s;
+			count = current;
+			if (count == (int)slots.size()) // forget the oldest
+			{
+				first = (first + 1) % slots.size();
+				count--;
+				current--;
+			}
+		}
 
-			show = 1;
-			if(c == 3)
-				show = 0;
+		// now = the state being undone, kept for redo
+		bool undo(const game_snapshot &now, game_snapshot &s)
+		{
+			if (current == 0)
+				return false;
+			if (current == count)
+				at(count++) = now;
+			s = at(--current);
+			return true;
+		}
+
+		bool redo(game_snapshot &s)
+		{
+			if (current + 1 >= count)
+				return false;
+			s = at(++current);
+			return true;
+		}
+
+	private:
+		vector<game_snapshot> slots;
+		int first, count, current; // the oldest slot, snapshots held, and the one the game is at
 
-			type = c;
+		game_snapshot &at(int k)
+		{
+			return slots[(first + k) % slots.size()];
 		}
 };
-vector<tiles> grid;
+undo_ring history;
 
-void init_grid()
+game_snapshot snapshot_game()
 {
-	game_progress = 0;
-	take_action = false;
+	game_snapshot s;
+	memset(&s, 0, sizeof(s));
+	s.pose = piece;
+	s.moves = piece.moves;
+	s.hash = state_hash;
+	for(int k = 0; k < grid.size(); k++)
+	{
+		s.show[k >> 6] |= (unsigned long long)(grid.show[k] != 0) << (k & 63);
+		s.state[k >> 6] |= (unsigned long long)(grid.state[k] != 0) << (k & 63);
+	}
+	return s;
+}
+
+void record_move()
+{
+	if(grid.size() <= max_snapshot_tiles)
+		history.push(snapshot_game());
+}
+
+int level_serial = 0; // bumped whenever grid is rebuilt
+const float tile_y = -1*(side + side/10); // height of the center of every tile
+
+mesh reg, frag, bridge, swch, hint;
+
+/* The draws of a level, built by init_grid: one indirect command per mesh,
+   over instances laid out as [cuboid | tiles grouped by type | every tile,
+   for the hint marker]. A frame only rewrites the draw flags, so the number
+   of draw calls does not depend on the level. */
+const int DRAW_CUBOID = 0, DRAW_HINT = 5, num_draws = 6; // tile types 1 - 4 draw in between
+class draw_list {
+	public:
+		vector<int> order; // tile indices grouped by type; instance 1 + k is tile order[k]
+		draw_command commands[num_draws];
+};
+draw_list draws;
+
+void build_draws()
+{
+	mesh meshes[num_draws] = { piece.obj, reg, frag, bridge, swch, hint };
+	for (int d = 0; d < num_draws; d++)
+		draws.commands[d] = scene.ranges[meshes[d]];
+
+	draws.commands[DRAW_CUBOID].instanceCount = 1;
+	draws.commands[DRAW_CUBOID].baseInstance = 0;
+
+	draws.order.clear();
+	for (int t = 1; t < DRAW_HINT; t++) // the goal is a hole, it has no draw
+	{
+		draw_command &c = draws.commands[t];
+		c.baseInstance = 1 + draws.order.size();
+		for (int k = 0; k < grid.size(); k++)
+			if (grid.type[k] == t)
+				draws.order.push_back(k);
+		c.instanceCount = 1 + draws.order.size() - c.baseInstance;
+	}
+
+	draws.commands[DRAW_HINT].instanceCount = grid.size(); // render() zeroes it when no hint is shown
+	draws.commands[DRAW_HINT].baseInstance = 1 + draws.order.size();
+}
+
+/* Hint engine: distance-to-goal table of the current level, computed off the
+   main thread when the level loads */
+struct hint_table {
+	int ind; // index of the level in maps
+	board level;
+	distance_field field;
+	atomic<bool> ready;
+};
+shared_ptr<hint_table> hints;
+bool show_hint = false; // highlight the next optimal move
+bool show_path = false; // highlight the whole optimal path
+
+/* The hint steps last worked out, for the table, state_hash and show_path
+   they were worked out for */
+struct hint_memo {
+	shared_ptr<hint_table> table;
+	unsigned long long hash;
+	bool path;
+	vector<pose> steps;
+};
+hint_memo hinted;
 
-	while(grid.size() > 0)
-    {
-        grid.erase(grid.begin());
-    }
+shared_ptr<hint_table> make_hints(int ind, const level_def &def)
+{
+	shared_ptr<hint_table> table = make_shared<hint_table>();
+	table->ind = ind;
+	table->level = load_level(def);
+	table->ready = false;
+	return table;
+}
+
+/* A decoded level, ready to be swapped in by init_grid */
+struct level_data {
+	int ind;
+	tile_store grid;
+	int start_i, start_j;
+	shared_ptr<hint_table> hints; // null when decoded on the main thread
+};
+
+shared_ptr<level_data> decode_level(int ind, const level_def &def)
+{
+	shared_ptr<level_data> level = make_shared<level_data>();
+	level->ind = ind;
+	level->start_i = level->start_j = 0;
 	for(int i = 0; i < max_map_size; i++)
 	{
 		for(int j= 0; j < max_map_size; j++)
 		{
-			if (maps[mapInd][i][j] != 0)
+			if (def.cells[i][j] != 0)
 			{
-				if (maps[mapInd][i][j] == -1)
+				if (def.cells[i][j] == -1)
 				{
-					tiles tile(i, j, 1);
-					tile.state = 1;
-					
-					piece.x = (i - map_center_i) * side;
-					piece.y = 0;
-					piece.z = -1*(j - map_center_j) * side;
-					piece.one_x = piece.two_x = piece.x;
-					piece.one_y = piece.y + side/2;
-					piece.two_y = piece.y - side/2;
-					piece.one_z = piece.two_z = piece.z;
-					piece.rotation = glm::mat4(1.0f);
-					piece.state = 1;
-
-					// cout << (tile.x == piece.x) << " " << (tile.z == piece.z) << endl;
-					grid.push_back(tile);
+					level->grid.add(i, j, 1);
+					level->grid.state.back() = 1;
+					level->start_i = i;
+					level->start_j = j;
 				}
 				else
+					level->grid.add(i, j, def.cells[i][j]);
+			}
+		}
+	}
+	return level;
+}
+
+/* Decodes upcoming levels (and their hint tables) on the job system while
+   the current one is played, so switching levels is a swap */
+class level_loader {
+	public:
+		mutex lock;
+		deque<int> pending; // levels being decoded
+		map<int, shared_ptr<level_data> > ready;
+		map<int, shared_ptr<hint_table> > hint_cache;
+		int generation; // bumped when the levels are reloaded; jobs started before publish nothing
+
+		level_loader()
+		{
+			generation = 0;
+		}
+
+		// decoded level, or null if it has not been streamed in yet
+		shared_ptr<level_data> take(int ind)
+		{
+			lock_guard<mutex> guard(lock);
+			shared_ptr<level_data> level;
+			if (ready.count(ind))
+			{
+				level = ready[ind];
+				ready.erase(ind);
+			}
+			return level;
+		}
+
+		// keep the current level (for R), the next two and the first (for ENTER) decoded
+		void prefetch(int current)
+		{
+			if (jobs.size() == 0)
+				return;
+			int wanted[4] = { current, current + 1, current + 2, 0 };
+			vector<int> starting;
+			vector<shared_ptr<hint_table> > tables;
+			{
+				lock_guard<mutex> guard(lock);
+				for (map<int, shared_ptr<level_data> >::iterator it = ready.begin(); it != ready.end(); )
 				{
-					tiles tile(i, j, maps[mapInd][i][j]);
-					tile.state = 0;
-					grid.push_back(tile);
+					if (it->first != wanted[0] && it->first != wanted[1] && it->first != wanted[2] && it->first != wanted[3])
+						ready.erase(it++);
+					else
+						++it;
 				}
+				for (int k = 0; k < 4; k++)
+					if (wanted[k] < levels.size() && !ready.count(wanted[k]) && find(pending.begin(), pending.end(), wanted[k]) == pending.end())
+					{
+						pending.push_back(wanted[k]);
+						starting.push_back(wanted[k]);
+						tables.push_back(hint_cache[wanted[k]]);
+					}
 			}
+			for (int k = 0; k < starting.size(); k++)
+				load(starting[k], tables[k]);
 		}
-	}
+
+		// the levels were edited: forget everything decoded from the old ones
+		void reset()
+		{
+			lock_guard<mutex> guard(lock);
+			generation++;
+			ready.clear();
+			hint_cache.clear();
+		}
+
+		// decode and hint table jobs side by side, joined by a continuation
+		void load(int ind, shared_ptr<hint_table> table)
+		{
+			shared_ptr<level_data> level = make_shared<level_data>();
+			level_def def = levels[ind]; // the jobs get a copy, levels may be reloaded meanwhile
+			int started = generation;
+			job *publish = jobs.create([this, ind, level, started]() {
+				lock_guard<mutex> guard(lock);
+				pending.erase(find(pending.begin(), pending.end(), ind));
+				if (started != generation)
+					return;
+				hint_cache[ind] = level->hints;
+				ready[ind] = level;
+			});
+			job *decode = jobs.create([ind, def, level, table]() {
+				shared_ptr<level_data> decoded = decode_level(ind, def);
+				level->grid.swap(decoded->grid);
+				level->ind = ind;
+				level->start_i = decoded->start_i;
+				level->start_j = decoded->start_j;
+				if (table)
+					level->hints = table;
+			});
+			jobs.then(decode, publish);
+			if (!table)
+			{
+				job *solve = jobs.create([ind, def, level]() {
+					shared_ptr<hint_table> built = make_hints(ind, def);
+					built->field = build_distance_field(built->level);
+					built->ready = true;
+					level->hints = built;
+				});
+				jobs.then(solve, publish);
+				jobs.submit(solve);
+			}
+			jobs.submit(decode);
+			jobs.submit(publish);
+		}
+};
+level_loader loader;
+
+// build the hint table of the current level in the background
+void request_hints()
+{
+	shared_ptr<hint_table> table = make_hints(mapInd, levels[mapInd]);
+	hints = table;
+	jobs.run([table]() {
+		table->field = build_distance_field(table->level);
+		table->ready = true;
+	});
 }
 
-bool is_occupied(int cube, float x, float z)
+/* The attempt at the level being played, recorded in the stats when it
+   ends: solved, fallen off, or restarted before either */
+struct attempt {
+	int level;
+	int moves_before; // piece.moves when it began
+	double start;
+	bool open;
+} current_attempt;
+
+void finish_attempt(int outcome)
 {
-	if (cube == 1)
-		if (piece.one_x == x)
-			if (piece.one_z == z)
-				return true;
-	
-	if (cube == 2)
-		if (piece.two_x == x)
-			if (piece.two_z == z)
-				return true;
+	if (!current_attempt.open)
+		return;
+	current_attempt.open = false;
+	if (outcome != ATTEMPT_RESET)
+		log_event(outcome == ATTEMPT_SOLVED ? SESSION_SOLVED : SESSION_FELL);
+	stats_record r;
+	r.level = current_attempt.level;
+	r.outcome = outcome;
+	r.reserved = 0;
+	r.moves = piece.moves - current_attempt.moves_before;
+	r.milliseconds = (glfwGetTime() - current_attempt.start)*1000;
+	r.time = time(NULL);
+	stats.record(r);
+}
+
+// a new attempt from where the cuboid is, as after an undo out of a lost level
+void open_attempt()
+{
+	current_attempt.level = mapInd;
+	current_attempt.moves_before = piece.moves;
+	current_attempt.start = glfwGetTime();
+	current_attempt.open = true;
+}
+
+void begin_attempt()
+{
+	finish_attempt(ATTEMPT_RESET);
+	log_event(SESSION_LEVEL, mapInd);
+	open_attempt();
+}
+
+void stop_stats ()
+{
+	finish_attempt(ATTEMPT_RESET);
+	stats.stop();
+}
+
+void init_grid()
+{
+	game_progress = 0;
+	begin_attempt();
+	take_action = false;
 
-	return false;	
+	shared_ptr<level_data> level = loader.take(mapInd);
+	if (!level) // not streamed in yet
+		level = decode_level(mapInd, levels[mapInd]);
+	grid.swap(level->grid);
+	history.clear();
+	level_serial++;
+	build_draws();
+	piece.place(level->start_i, level->start_j);
+	state_hash = hash_state();
+
+	if (level->hints)
+		hints = level->hints;
+	else if (!hints || hints->ind != mapInd)
+		request_hints();
+
+	loader.prefetch(mapInd);
+}
+
+/* Swap in an edited version of the level being played. Tiles that kept
+   their cell and type keep their state (bridges, broken fragile tiles), and
+   the cuboid stays where it is if the new tiles still hold it up; otherwise
+   the level restarts. */
+void reload_level()
+{
+	loader.reset();
+	hints.reset();
+	if (mapInd >= levels.size())
+		mapInd = 0;
+	else if (game_progress == 0)
+	{
+		shared_ptr<level_data> level = decode_level(mapInd, levels[mapInd]);
+		tile_store &fresh = level->grid;
+		for(int k = 0; k < fresh.size(); k++)
+			for(int c = 0; c < grid.size(); c++)
+				if(grid.i[c] == fresh.i[k] && grid.j[c] == fresh.j[k] && grid.type[c] == fresh.type[k])
+				{
+					fresh.show[k] = grid.show[c];
+					fresh.state[k] = grid.state[c];
+				}
+
+		bool held1 = false, held2 = false, standing = piece.state == 1;
+		for(int k = 0; k < fresh.size(); k++)
+		{
+			if(!fresh.show[k] || (standing && (fresh.type[k] == 2 || fresh.type[k] == 5)))
+				continue;
+			held1 = held1 || (fresh.x[k] == piece.one_x() && fresh.z[k] == piece.one_z());
+			held2 = held2 || (fresh.x[k] == piece.two_x() && fresh.z[k] == piece.two_z());
+		}
+		if(held1 && held2)
+		{
+			grid.swap(fresh);
+			history.clear(); // the snapshots are of the old tiles
+			state_hash = hash_state();
+			level_serial++;
+			build_draws();
+			request_hints();
+			loader.prefetch(mapInd);
+			cout << "Level " << mapInd + 1 << " reloaded" << endl;
+			return;
+		}
+	}
+	init_grid();
+	cout << "Level " << mapInd + 1 << " reloaded, restarted" << endl;
 }
 
 void toggle_bridge(int i, int j)
 {
 	for(int a = 0; a < max_switches; a++)
 	{
-		if(switches[mapInd][a][0] == i && switches[mapInd][a][1] == j)
+		if(levels[mapInd].switches[a][0] == i && levels[mapInd].switches[a][1] == j)
 		{
 			for(int b = 2; b < max_switch_size; b+=2)
 			{
 				for(int c = 0; c < grid.size(); c++)
 				{
-					if(grid[c].i == switches[mapInd][a][b] && grid[c].j == switches[mapInd][a][b + 1])
+					if(grid.i[c] == levels[mapInd].switches[a][b] && grid.j[c] == levels[mapInd].switches[a][b + 1] && grid.type[c] == 3)
 					{
-						grid[c].show = !grid[c].show;
+						grid.show[c] = !grid.show[c];
+						state_hash ^= hidden_key(grid.i[c], grid.j[c]);
 					}
 				}
 			}
@@ -620,89 +1250,256 @@ void toggle_bridge(int i, int j)
 	}
 }
 
-// Eye - Location of camera. Don't change unless you are sure!!
-// glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-glm::vec3 eye (4, 4, 4);
-// Target - Where is the camera looking at.  Don't change unless you are sure!!
-glm::vec3 target (0, 0, 0);
+/* Headless pose of the cuboid and bridges, as the hint engine sees them */
+pose current_pose()
+{
+	pose p;
+	p.i = piece.one_x()/2 + map_center_i;
+	p.j = map_center_j - piece.one_z()/2;
+	p.state = piece.state;
+	p.bridges = 0;
+	for(int k = 0; k < grid.size(); k++)
+	{
+		int c = hints->level.cell(grid.i[k], grid.j[k]);
+		if(grid.type[k] == 3 && grid.show[k] && hints->level.bridge_bit[c] != -1)
+			p.bridges |= 1u << hints->level.bridge_bit[c];
+	}
+	return p;
+}
+
 // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
 glm::vec3 up (0, 1, 0);
 
-int view_mode = 0;
-float r;
-double theta; // angle against x on xy plane
-double phi; // angle against z axis
-void change_camera()
-{
-	// cout << view_mode << endl;
-	switch(view_mode) {
-		case 0: // Tower view
+const double view_transition = 0.5; // seconds spent easing into a new view
+
+/* The five views. The view and VP matrices are cached and only rebuilt when
+   the mode, panning, zoom, the projection or the cuboid followed change. A
+   new mode is eased into from wherever the camera was. */
+class camera {
+	public:
+		int mode; // 0 tower, 1 top, 2 block, 3 follow, 4 helicopter
+		float r; // helicopter view: distance from the centre
+		double theta; // angle against x on xy plane
+		double phi; // angle against z axis
+		glm::vec3 eye, target;
+		glm::mat4 view, VP;
+
+		camera()
+		{
+			mode = 0;
 			r = 8;
-			theta = 45; // angle against x on xy plane
-			phi = 45; // angle against z axis
+			theta = phi = 45;
+			eye = glm::vec3(-2, 5, 8);
+			target = glm::vec3(0, 0, 0);
+			goal = glm::vec3(0, 0, 0);
+			goal_serial = -1;
+			dirty = true;
+			moving = false;
+		}
 
-			eye[0] = -2;
-			eye[1] = 5;
-			eye[2] = 8;
+		void set_mode(int m, double now, bool smooth = true)
+		{
+			if (smooth)
+			{
+				from_eye = eye;
+				from_target = target;
+				transition_start = now;
+				moving = true;
+			}
+			mode = m;
+			if (mode == 0) // the tower view starts the helicopter over
+			{
+				r = 8;
+				theta = phi = 45;
+			}
+			dirty = true;
+		}
 
-			target[0] = 0;
-			target[1] = 0;
-			target[2] = 0;
-			break;
-		case 1: // Top view
-			eye[0] = eye[2] = 0.1;
-			eye[1] = 4;
+		void orbit(double d_theta, double d_phi)
+		{
+			if (mode == 0)
+				return;
+			theta += d_theta;
+			phi += d_phi;
+			dirty = true;
+		}
 
-			target[0] = 0;
-			target[1] = 0;
-			target[2] = 0;
-			break;
-		case 2: // Block view
-			eye[0] = piece.x;
-			eye[1] = piece.y + side*2;
-			eye[2] = piece.z;
+		void set_orbit(float radius, double t, double p)
+		{
+			r = radius;
+			theta = t;
+			phi = p;
+			dirty = true;
+		}
 
-			for(int k = 0; k < grid.size(); k++)
+		void zoom(float d_r)
+		{
+			if (mode == 0)
+				return;
+			r += d_r;
+			dirty = true;
+		}
+
+		void set_projection(const glm::mat4 &p)
+		{
+			projection = p;
+			dirty = true;
+		}
+
+		// rebuild the matrices if anything they depend on changed
+		void update(double now)
+		{
+			glm::vec3 position = piece.position();
+			if ((mode == 2 || mode == 3) && (position != followed || goal_serial != level_serial))
+				dirty = true;
+			if (!dirty && !moving)
+				return;
+
+			glm::vec3 e, t;
+			aim(position, e, t);
+			if (moving)
 			{
-				if(grid[k].type == 5)
+				float k = (now - transition_start) / view_transition;
+				if (k >= 1)
+					moving = false;
+				else
 				{
-					target[0] = grid[k].x;
-					target[1] = 0;
-					target[2] = grid[k].z;
-					break;
+					k = k*k*(3 - 2*k); // smoothstep
+					e = glm::mix(from_eye, e, k);
+					t = glm::mix(from_target, t, k);
 				}
 			}
-			break;
-		case 3: // Follow view
-			eye[0] = piece.x;
-			eye[1] = piece.y + side*2;
-			eye[2] = piece.z + side*4;
+			eye = e;
+			target = t;
+			followed = position;
+			view = glm::lookAt(eye, target, up);
+			VP = projection * view;
+			dirty = false;
+		}
 
-			for(int k = 0; k < grid.size(); k++)
-			{
-				if(grid[k].type == 5)
-				{
-					target[0] = grid[k].x;
-					target[1] = 0;
-					target[2] = grid[k].z;
+	private:
+		glm::mat4 projection;
+		glm::vec3 followed; // cuboid position the matrices were built for
+		glm::vec3 goal; // centre of the goal tile of level goal_serial
+		int goal_serial;
+		bool dirty;
+		bool moving; // easing into the mode from from_eye and from_target
+		glm::vec3 from_eye, from_target;
+		double transition_start;
+
+		// where the mode puts the camera and what it looks at
+		void aim(const glm::vec3 &position, glm::vec3 &e, glm::vec3 &t)
+		{
+			t = glm::vec3(0, 0, 0);
+			switch(mode) {
+				case 0: // Tower view
+					e = glm::vec3(-2, 5, 8);
+					break;
+				case 1: // Top view
+					e = glm::vec3(0.1, 4, 0.1);
+					break;
+				case 2: // Block view
+					e = position + glm::vec3(0, side*2, 0);
+					t = goal_position();
+					break;
+				case 3: // Follow view
+					e = position + glm::vec3(0, side*2, side*4);
+					t = goal_position();
+					break;
+				default: // Helicopter view
+					e = glm::vec3(r*sin(phi)*cos(theta), r*sin(phi)*sin(theta), r*cos(phi));
 					break;
-				}
 			}
-			break;
-		case 4: // Helicopter view
-			// cout << theta << " " << phi << endl;
-			eye[0] = r*sin(phi)*cos(theta);
-			eye[1] = r*sin(phi)*sin(theta);
-			eye[2] = r*cos(phi);
-
-			target[0] = 0;
-			target[1] = 0;
-			target[2] = 0;
-			break;
-		default:
-			break;
-	}
-}
+		}
+
+		glm::vec3 goal_position()
+		{
+			if (goal_serial != level_serial)
+			{
+				goal_serial = level_serial;
+				for(int k = 0; k < grid.size(); k++)
+					if(grid.type[k] == 5)
+					{
+						goal = glm::vec3(grid.x[k]*side/2, 0, grid.z[k]*side/2);
+						break;
+					}
+			}
+			return goal;
+		}
+};
+camera cam;
+
+/* Input latency of every move in the session: when the key reached
+   keyboard(), when the tile rules first ran on the new pose and when the
+   first frame showing it was swapped. Indexed by move serial; the render
+   thread only writes presented. */
+class latency_log {
+	public:
+		static const int capacity = 1 << 14; // moves kept; older ones are overwritten
+		vector<double> input, applied, presented;
+		int inputs, applies; // moves recorded at each stage, main thread
+		atomic<int> presents;
+
+		latency_log() : input(capacity), applied(capacity), presented(capacity)
+		{
+			inputs = applies = 0;
+			presents = 0;
+		}
+
+		void key(double t)
+		{
+			input[inputs % capacity] = t;
+			inputs++;
+		}
+
+		void apply(double t)
+		{
+			for (; applies < inputs; applies++)
+				applied[applies % capacity] = t;
+		}
+
+		// a frame with moves up to serial was swapped
+		void present(int serial, double t)
+		{
+			int k = presents;
+			for (; k < serial; k++)
+				presented[k % capacity] = t;
+			presents = k;
+		}
+
+		// percentiles in ms of the stage from - to over the presented moves, as JSON
+		static void print_stage(const char *name, const vector<double> &from, const vector<double> &to, int count, bool last)
+		{
+			vector<double> ms;
+			for (int k = max(count - capacity, 0); k < count; k++)
+				ms.push_back((to[k % capacity] - from[k % capacity])*1000);
+			sort(ms.begin(), ms.end());
+			double sum = 0;
+			for (int k = 0; k < ms.size(); k++)
+				sum += ms[k];
+			cout << "    \"" << name << "\": { \"mean\": " << sum / ms.size()
+				<< ", \"p50\": " << ms[ms.size()*50/100]
+				<< ", \"p90\": " << ms[ms.size()*90/100]
+				<< ", \"p99\": " << ms[ms.size()*99/100]
+				<< ", \"max\": " << ms.back() << " }" << (last ? "" : ",") << "\n";
+		}
+
+		void report()
+		{
+			int count = presents;
+			if (count == 0)
+				return;
+			cout << "{\n  \"moves\": " << count << ",\n  \"latency_ms\": {\n";
+			print_stage("input_to_applied", input, applied, count, false);
+			print_stage("applied_to_presented", applied, presented, count, false);
+			print_stage("input_to_presented", input, presented, count, true);
+			cout << "  }\n}" << endl;
+		}
+};
+latency_log latency;
+
+void undo ();
+void redo ();
 
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
@@ -712,21 +1509,27 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 	if (action == GLFW_RELEASE) {
 		switch (key) {
 			case GLFW_KEY_C:
-				rectangle_rot_status = !rectangle_rot_status;
-				view_mode = (view_mode + 1) % 5;
-				break;
-			case GLFW_KEY_P:
-				triangle_rot_status = !triangle_rot_status;
+				cam.set_mode((cam.mode + 1) % 5, glfwGetTime());
 				break;
 			case GLFW_KEY_X:
 				// do something ..
 				break;
+			case GLFW_KEY_H:
+				show_hint = !show_hint;
+				break;
+			case GLFW_KEY_O:
+				show_path = !show_path;
+				break;
 			case GLFW_KEY_R:
-				if(mapInd != max_maps)
+				if(mapInd != levels.size())
+				{
+					log_event(SESSION_RESET);
 					init_grid();
+				}
 			case GLFW_KEY_N:
-				if(mapInd+1 != max_maps && game_progress == 1)
+				if(mapInd+1 != levels.size() && game_progress == 1)
 				{
+					log_event(SESSION_NEXT);
 					mapInd++;
 					init_grid();
 				}
@@ -736,8 +1539,10 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 		}
 	}
 	else if (action == GLFW_PRESS) {
+		double pressed = glfwGetTime(); // latency is only measured for presses that move the cuboid
 		switch (key) {
 			case GLFW_KEY_ENTER:
+				log_event(SESSION_RESTART);
 				mapInd = 0;
 				piece.moves = 0;
 				init_grid();
@@ -746,16 +1551,32 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 				quit(window);
 				break;
 			case GLFW_KEY_LEFT:
-				piece.move(0);
+				log_event(SESSION_MOVE, 0);
+				if (piece.move(0))
+					latency.key(pressed);
 				break;
 			case GLFW_KEY_RIGHT:
-				piece.move(1);
+				log_event(SESSION_MOVE, 1);
+				if (piece.move(1))
+					latency.key(pressed);
 				break;
 			case GLFW_KEY_UP:
-				piece.move(2);
+				log_event(SESSION_MOVE, 2);
+				if (piece.move(2))
+					latency.key(pressed);
 				break;
 			case GLFW_KEY_DOWN:
-				piece.move(3);
+				log_event(SESSION_MOVE, 3);
+				if (piece.move(3))
+					latency.key(pressed);
+				break;
+			case GLFW_KEY_Z:
+				log_event(SESSION_RESET, SESSION_UNDO);
+				undo();
+				break;
+			case GLFW_KEY_Y:
+				log_event(SESSION_RESET, SESSION_REDO);
+				redo();
 				break;
 			default:
 				break;
@@ -783,13 +1604,8 @@ float mousePanX, mousePanY;
 void mouseButton (GLFWwindow* window, int button, int action, int mods)
 {
 	switch (button) {
-		case GLFW_MOUSE_BUTTON_LEFT:
-			if (action == GLFW_RELEASE)
-				triangle_rot_dir *= -1;
-			break;
 		case GLFW_MOUSE_BUTTON_RIGHT:
 			if (action == GLFW_RELEASE) {
-                rectangle_rot_dir *= -1;
                 if (pan_drag)
                 	pan_drag = false;
             }
@@ -809,8 +1625,7 @@ void pan(int x, int y)
 {
 	// PAN += direction*0.1;
 	// cout << x << " " << y << endl;
-	theta -= y*0.01;
-	phi += x*0.01;
+	cam.orbit(-y*0.01, x*0.01);
 }
 
 void mousePos (GLFWwindow* window, double x, double y)
@@ -829,8 +1644,8 @@ void mousePos (GLFWwindow* window, double x, double y)
 
 void zoom(int direction) // -1: out, 1: in
 {
-	r -= direction*1;
-    cout <<  "ZOOM: x" << r <<endl;
+	cam.zoom(-direction);
+    cout <<  "ZOOM: x" << cam.r <<endl;
 }
 
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
@@ -838,83 +1653,34 @@ void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
     zoom(yoffset);
 }
 
+int viewport_width, viewport_height;
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (GLFWwindow* window, int width, int height)
 {
-	int fbwidth=width, fbheight=height;
-	/* With Retina display on Mac OS X, GLFW's FramebufferSize
-	 is different from WindowSize */
-	glfwGetFramebufferSize(window, &fbwidth, &fbheight);
-
-	GLfloat fov = 90.0f;
-
-	// sets the viewport of openGL renderer
-	glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
-
-	// set the projection matrix as perspective
-	/* glMatrixMode (GL_PROJECTION);
-	   glLoadIdentity ();
-	   gluPerspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1, 500.0); */
-	// Store the projection matrix in a variable for future use
-	// Perspective projection for 3D views
-	Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
-
-	// Ortho projection for 2D views
-	// Matrices.projection = glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.1f, 500.0f);
-}
-
-VAO *triangle, *rectangle;
-VAO *reg, *frag, *bridge, *swch;
-
-// Creates the triangle object used in this sample code
-void createTriangle ()
-{
-	/* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
-
-	/* Define vertex array as used in glBegin (GL_TRIANGLES) */
-	static const GLfloat vertex_buffer_data [] = {
-		0, 1,0, // vertex 0
-		-1,-1,0, // vertex 1
-		1,-1,0, // vertex 2
-	};
-
-	static const GLfloat color_buffer_data [] = {
-		1,0,0, // color 0
-		0,1,0, // color 1
-		0,0,1, // color 2
-	};
-
-	// create3DObject creates and returns a handle to a VAO that can be used later
-	triangle = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_LINE);
-}
-
-// Creates the rectangle object used in this sample code
-void createRectangle ()
-{
-	// GL3 accepts only Triangles. Quads are not supported
-	static const GLfloat vertex_buffer_data [] = {
-		-1.2,-1,0, // vertex 1
-		1.2,-1,0, // vertex 2
-		1.2, 1,0, // vertex 3
+	int fbwidth=width, fbheight=height;
+	/* With Retina display on Mac OS X, GLFW's FramebufferSize
+	 is different from WindowSize */
+	glfwGetFramebufferSize(window, &fbwidth, &fbheight);
 
-		1.2, 1,0, // vertex 3
-		-1.2, 1,0, // vertex 4
-		-1.2,-1,0  // vertex 1
-	};
+	GLfloat fov = 90.0f;
 
-	static const GLfloat color_buffer_data [] = {
-		1,0,0, // color 1
-		0,0,1, // color 2
-		0,1,0, // color 3
+	// sets the viewport of openGL renderer; applied by render(), which may run on another thread
+	viewport_width = fbwidth;
+	viewport_height = fbheight;
 
-		0,1,0, // color 3
-		0.3,0.3,0.3, // color 4
-		1,0,0  // color 1
-	};
+	// set the projection matrix as perspective
+	/* glMatrixMode (GL_PROJECTION);
+	   glLoadIdentity ();
+	   gluPerspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1, 500.0); */
+	// Store the projection matrix in a variable for future use
+	// Perspective projection for 3D views
+	Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
+	cam.set_projection(Matrices.projection);
 
-	// create3DObject creates and returns a handle to a VAO that can be used later
-	rectangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+	// Ortho projection for 2D views
+	// Matrices.projection = glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.1f, 500.0f);
 }
 
 // creates the tile objects
@@ -1177,16 +1943,28 @@ void createTiles()
 		1,1,1,
 	};
 
-	// create3DObject creates and returns a handle to a VAO that can be used later
-	reg = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, reg_color_buffer_data, GL_FILL);
-	frag = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, frag_color_buffer_data, GL_FILL);
-	bridge = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, bridge_color_buffer_data, GL_FILL);
-	swch = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, swch_color_buffer_data, GL_FILL);
+	// create3DObject packs the triangles and returns a handle to the mesh
+	reg = create3DObject(12*3, vertex_buffer_data, reg_color_buffer_data);
+	frag = create3DObject(12*3, vertex_buffer_data, frag_color_buffer_data);
+	bridge = create3DObject(12*3, vertex_buffer_data, bridge_color_buffer_data);
+	swch = create3DObject(12*3, vertex_buffer_data, swch_color_buffer_data);
 }
 
-float camera_rotation_angle = 90;
-float rectangle_rotation = 0;
-float triangle_rotation = 0;
+// creates the marker laid on tiles suggested by the hint engine
+void createHint()
+{
+	static const GLfloat vertex_buffer_data [] = {
+		-0.4f*side, side/10 + side/50, 0.4f*side,
+		0.4f*side, side/10 + side/50, 0.4f*side,
+		-0.4f*side, side/10 + side/50, -0.4f*side,
+
+		0.4f*side, side/10 + side/50, 0.4f*side,
+		-0.4f*side, side/10 + side/50, -0.4f*side,
+		0.4f*side, side/10 + side/50, -0.4f*side,
+	};
+
+	hint = create3DObject(2*3, vertex_buffer_data, 0.2f, 1.0f, 0.2f);
+}
 
 float fall_speed;
 const float gravity = 10;
@@ -1197,7 +1975,7 @@ void init_game()
 	if(game_progress == 1)
 	{
 		// mapInd++;
-		if(mapInd+1 >= max_maps)
+		if(mapInd+1 >= levels.size())
 		{
 			cout << "All Levels Completed!" << endl;
 			cout << "Total moves used: " << piece.moves << endl;
@@ -1223,39 +2001,109 @@ void init_game()
 	}
 }
 
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
-void draw ()
+// back in play at s, picking the cuboid up again if it had fallen off or reached the goal
+void restore_game(const game_snapshot &s)
 {
-	// clear the color and depth in the frame buffer
-	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	static_cast<lattice_pose &>(piece) = s.pose;
+	piece.moves = s.moves;
+	piece.fall = 0;
+	state_hash = s.hash;
+	for(int k = 0; k < grid.size(); k++)
+	{
+		grid.show[k] = (s.show[k >> 6] >> (k & 63)) & 1;
+		grid.state[k] = (s.state[k >> 6] >> (k & 63)) & 1;
+	}
+	assert(state_hash == hash_state());
+	if(game_progress != 0)
+	{
+		game_progress = 0;
+		take_action = false;
+		fall_speed = 300;
+		open_attempt();
+	}
+}
 
-	// use the loaded shader program
-	// Don't change unless you know what you are doing
-	glUseProgram (programID);
+void undo ()
+{
+	game_snapshot s;
+	if(history.undo(snapshot_game(), s))
+		restore_game(s);
+}
 
-	// Compute Camera matrix (view)
-	change_camera();
-	Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-	//  Don't change unless you are sure!!
-	// Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+void redo ()
+{
+	game_snapshot s;
+	if(history.redo(s))
+		restore_game(s);
+}
 
-	// Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-	//  Don't change unless you are sure!!
-	glm::mat4 VP = Matrices.projection * Matrices.view;
+/* Everything render() needs for one frame, copied out of the game state so
+   the simulation and the renderer can run on different threads */
+struct frame_snapshot {
+	int level_serial; // level the tile positions and types were copied from
+	int move_serial; // moves applied so far
+	vector<short> x, z;
+	vector<signed char> type;
+	vector<int> order; // as in draw_list
+	draw_command commands[num_draws];
+	vector<unsigned char> show;
+	glm::mat4 cuboid; // model matrix of the cuboid
+	bool show_cuboid;
+	vector<pose> hint_steps; // poses along the highlighted moves
+	glm::mat4 VP; // view and projection, as cached by the camera
+	int viewport_width, viewport_height;
+
+	frame_snapshot()
+	{
+		level_serial = -1;
+		move_serial = 0;
+		show_cuboid = false;
+		viewport_width = viewport_height = 0;
+	}
+};
 
-	// Send our transformation to the currently bound shader, in the "MVP" uniform
-	// For each model you render, since the MVP will be different (at least the M part)
-	//  Don't change unless you are sure!!
-	glm::mat4 MVP;	// MVP = Projection * View * Model
+/* Lock-free triple buffer: the simulation fills one snapshot while the
+   renderer reads another, the third holds the latest published one */
+class snapshot_buffer {
+	public:
+		frame_snapshot slots[3];
+		atomic<int> middle; // slot index, plus fresh when not yet taken by the renderer
+		int back, front;
+		static const int fresh = 4;
 
-	// Load identity to model matrix
-	Matrices.model = glm::mat4(1.0f);
+		snapshot_buffer()
+		{
+			back = 0;
+			middle = 1;
+			front = 2;
+		}
 
-	/* Render your scene */
+		frame_snapshot &write_slot()
+		{
+			return slots[back];
+		}
+
+		void publish()
+		{
+			back = middle.exchange(back | fresh) & 3;
+		}
+
+		// switch to the latest published snapshot, if there is a newer one
+		const frame_snapshot &read_slot()
+		{
+			if (middle.load() & fresh)
+				front = middle.exchange(front) & 3;
+			return slots[front];
+		}
+};
+snapshot_buffer snapshots;
 
+/* Advance the game by one frame: input driven panning, the fall animation
+   and the tile rules. Touches no GL state. */
+void update (bool tick)
+{
 	// PANNING
-	if (pan_drag)
+	if (tick && pan_drag)
 	{
 		// cout << mouseX << " " << mouseY << endl;
 		if(mouseX != mousePanX || mouseY != mousePanY)
@@ -1266,9 +2114,9 @@ void draw ()
 		}
 	}
 
-	if(game_progress != 0)
+	if(tick && game_progress != 0)
 	{
-		if(piece.y < -8)
+		if(piece.position().y < -8)
 		{
 			if(!take_action)
 			{
@@ -1279,123 +2127,477 @@ void draw ()
 		else
 		{
 			fall_speed += gravity*0.5;
-			piece.y -= (fall_speed + (gravity)*0.5*0.5/2)/10000;
+			piece.fall -= (fall_speed + (gravity)*0.5*0.5/2)/10000;
 		}
 	}
 
-	// CUBOID
-	glm::mat4 translateCuboid = glm::translate (glm::vec3(piece.x, piece.y, piece.z)); // glTranslatef
-	glm::mat4 cuboidTransform = translateCuboid * piece.rotation;
-	Matrices.model *= cuboidTransform; 
-	MVP = VP * Matrices.model; // MVP = p * V * M
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	if(game_progress == 0 || !take_action)
-		draw3DObject(piece.obj);
-	Matrices.model = glm::mat4(1.0f);
-
-	// GRID
+	// GRID - rule pass
+	// occupancy of every tile from the positions alone; a branch-free loop the compiler vectorizes
+	int n = grid.size();
+	int x1 = piece.one_x(), z1 = piece.one_z(), x2 = piece.two_x(), z2 = piece.two_z();
+	const short *tile_x = grid.x.data(), *tile_z = grid.z.data();
+	unsigned char *occupied = grid.occupied.data();
+	for(int k = 0; k < n; k++)
+		occupied[k] = (tile_x[k] == x1 && tile_z[k] == z1) | ((tile_x[k] == x2 && tile_z[k] == z2) << 1);
+
 	bool off_grid_1 = true, off_grid_2 = true;
-	for(int i = 0; i < grid.size(); i++)
+	for(int k = 0; k < n; k++)
 	{
-		glm::mat4 translateTile = glm::translate (glm::vec3(grid[i].x, grid[i].y, grid[i].z)); // glTranslatef
-		glm::mat4 tileTransform = translateTile;
-		Matrices.model *= tileTransform; 
-		MVP = VP * Matrices.model; // MVP = p * V * M
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-		bool occupied1 = is_occupied(1, grid[i].x, grid[i].z);
-		bool occupied2 = is_occupied(2, grid[i].x, grid[i].z);
-		
-		if(occupied1)
-			off_grid_1 = false;
-		if(occupied2)
-			off_grid_2 = false;
-
-		switch(grid[i].type) {
-			case 1: // regular tile
-				grid[i].state = (occupied1 || occupied2);
-				draw3DObject(reg);
-				break;
-			case 2: // fragile
-				grid[i].state = (occupied1 || occupied2);
-				if (occupied1 && occupied2) // breaking condition
-				{
-					grid[i].show = 0;
-					off_grid_1 = off_grid_2 = true;
-					// cout << "fragile tile broken" << endl;
-				}
-				if(grid[i].show)
-					draw3DObject(frag);
-				break;
-			case 3: // bridge
-				grid[i].state = (occupied1 || occupied2);
-				if (grid[i].show == 1)
-					draw3DObject(bridge);
-				if (grid[i].state == 1 && grid[i].show == 0)
-					off_grid_1 = off_grid_2 = true;
-				break;
-			case 4: // switch
-				if (occupied1 || occupied2)
-				{
-					if(grid[i].state == 0)
-						toggle_bridge(grid[i].i, grid[i].j);
-				}
-				grid[i].state = (occupied1 || occupied2);
-				draw3DObject(swch);
-				break;
-			case 5: // goal
-				grid[i].state = (occupied1 || occupied2);
-				if (occupied1 && occupied2)
-				{
-					game_progress = 1;
-					// cout << "goal" << endl;
-				}
-				break;
-			default:
-				break;
+		if(occupied[k])
+		{
+			bool occupied1 = occupied[k] & 1;
+			bool occupied2 = occupied[k] & 2;
+
+			if(occupied1)
+				off_grid_1 = false;
+			if(occupied2)
+				off_grid_2 = false;
+
+			switch(grid.type[k]) {
+				case 2: // fragile
+					if (occupied1 && occupied2) // breaking condition
+					{
+						if (grid.show[k]) // hidden once, so hashed once
+						{
+							grid.show[k] = 0;
+							state_hash ^= hidden_key(grid.i[k], grid.j[k]);
+						}
+						off_grid_1 = off_grid_2 = true;
+						// cout << "fragile tile broken" << endl;
+					}
+					break;
+				case 3: // bridge
+					if (grid.show[k] == 0)
+						off_grid_1 = off_grid_2 = true;
+					break;
+				case 4: // switch
+					if(grid.state[k] == 0)
+						toggle_bridge(grid.i[k], grid.j[k]);
+					break;
+				case 5: // goal
+					if (occupied1 && occupied2)
+					{
+						game_progress = 1;
+						// cout << "goal" << endl;
+					}
+					break;
+				default:
+					break;
+			}
 		}
-		Matrices.model = glm::mat4(1.0f);
+		grid.state[k] = occupied[k] != 0;
 	}
 
 	if (off_grid_1 || off_grid_2)
 	{
-		piece.move(last_move);
+		piece.move(last_move, false); // on over the edge, undone along with the move that got there
 		game_progress = -1;
 		// cout << "OFF GRID!" << endl;
 	}
+	if (game_progress != 0)
+		finish_attempt(game_progress == 1 ? ATTEMPT_SOLVED : ATTEMPT_FELL);
+	assert(state_hash == hash_state());
+	latency.apply(glfwGetTime());
+
+	// Compute Camera matrix (view), if anything it follows changed
+	cam.update(glfwGetTime());
+}
+
+/* Copy what the next frame shows out of the game state */
+void capture (frame_snapshot &s)
+{
+	if (s.level_serial != level_serial) // tiles only move when a level loads
+	{
+		s.x = grid.x;
+		s.z = grid.z;
+		s.type = grid.type;
+		s.order = draws.order;
+		memcpy(s.commands, draws.commands, sizeof(s.commands));
+		s.level_serial = level_serial;
+	}
+	s.show = grid.show;
+	s.move_serial = latency.applies;
+
+	s.cuboid = glm::translate (piece.position()) * piece.rotation_matrix();
+	s.show_cuboid = game_progress == 0 || !take_action;
+
+	// HINTS
+	s.hint_steps.clear();
+	if((show_hint || show_path) && game_progress == 0 && hints->ready)
+	{
+		if(hinted.table != hints || hinted.hash != state_hash || hinted.path != show_path)
+		{
+			hinted.table = hints;
+			hinted.hash = state_hash;
+			hinted.path = show_path;
+			hinted.steps.clear();
+			pose p = current_pose();
+			int steps = show_path ? hints->field.distance(hints->level, p) : 1;
+			for(int k = 0; k < steps; k++)
+			{
+				int dir = hints->field.hint(hints->level, p);
+				if(dir == -1)
+					break;
+				step(hints->level, p, dir);
+				hinted.steps.push_back(p);
+			}
+		}
+		s.hint_steps = hinted.steps;
+	}
+
+	s.VP = cam.VP;
+	s.viewport_width = viewport_width;
+	s.viewport_height = viewport_height;
+}
+
+/* Instance offsets of a newly loaded level, in the order of its draw list */
+void upload_offsets (const frame_snapshot &s)
+{
+	int n = s.type.size(), batched = s.order.size();
+	vector<glm::vec3> offsets (1 + batched + n); // the cuboid is placed by its matrix
+	scene.tile_at.clear();
+	for(int k = 0; k < n; k++)
+	{
+		offsets[1 + batched + k] = glm::vec3(s.x[k]*side/2, tile_y, s.z[k]*side/2);
+		scene.tile_at[tile_key(s.x[k], s.z[k])] = k;
+	}
+	for(int k = 0; k < batched; k++)
+		offsets[1 + k] = offsets[1 + batched + s.order[k]];
+
+	glBindBuffer(GL_ARRAY_BUFFER, scene.OffsetBuffer);
+	glBufferData(GL_ARRAY_BUFFER, offsets.size()*sizeof(glm::vec3), &offsets[0], GL_STATIC_DRAW);
+	scene.level_serial = s.level_serial;
+}
+
+int frame_move_serial = 0; // move_serial of the last snapshot rendered
+
+/* Render a snapshot with openGL. Only ever called on the thread owning the context. */
+void render (const frame_snapshot &s)
+{
+	if (shaders_changed.exchange(false))
+		reload_shaders();
+	frame_move_serial = s.move_serial;
+	static int applied_width = -1, applied_height = -1;
+	if (s.viewport_width != applied_width || s.viewport_height != applied_height)
+	{
+		glViewport (0, 0, (GLsizei) s.viewport_width, (GLsizei) s.viewport_height);
+		applied_width = s.viewport_width;
+		applied_height = s.viewport_height;
+	}
+
+	// clear the color and depth in the frame buffer
+	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// use the loaded shader program
+	// Don't change unless you know what you are doing
+	glUseProgram (programID);
+
+	// ViewProject matrix, rebuilt by the camera only when it moved
+	const glm::mat4 &VP = s.VP;
+
+	// Everything that changes per frame goes into the uniform ring: the Frame
+	// block, a draw flag per instance and the commands. Then the whole scene
+	// is drawn from the shared buffers.
+	if (s.level_serial != scene.level_serial)
+		upload_offsets(s);
+	int n = s.type.size(), batched = s.order.size();
+	int hinted = s.hint_steps.empty() ? 0 : n;
+	int instances = 1 + batched + hinted;
+	uniforms.begin_frame(uniforms.aligned(2*sizeof(glm::mat4)) + uniforms.aligned(instances) + uniforms.aligned(sizeof(s.commands)));
+	void *data;
+
+	/* Render your scene */
+
+	// CAMERA and CUBOID
+	GLintptr frame_offset = uniforms.alloc(2*sizeof(glm::mat4), &data);
+	memcpy(data, &VP[0][0], sizeof(glm::mat4));
+	memcpy((char*)data + sizeof(glm::mat4), &s.cuboid[0][0], sizeof(glm::mat4));
+
+	// GRID: 0 = hidden, 1 = at the offset of the instance, 2 = by the cuboid matrix
+	GLintptr flags_offset = uniforms.alloc(instances, &data);
+	unsigned char *flags = (unsigned char*)data;
+	flags[0] = s.show_cuboid ? 2 : 0;
+	for(int k = 0; k < batched; k++)
+		flags[1 + k] = s.show[s.order[k]];
+
+	// HINTS: flags of the marker instances, one per tile
+	if(hinted)
+	{
+		unsigned char *marked = flags + 1 + batched;
+		memset(marked, 0, n);
+		for(int k = 0; k < s.hint_steps.size(); k++)
+		{
+			const pose &p = s.hint_steps[k];
+			int i2, j2;
+			cube_cells(p, i2, j2);
+			int cells[2][2] = { { p.i, p.j }, { i2, j2 } };
+			for(int c = 0; c < (p.state == 1 ? 1 : 2); c++)
+			{
+				int x = 2*(cells[c][0] - map_center_i), z = -2*(cells[c][1] - map_center_j);
+				unordered_map<unsigned, int>::const_iterator tile = scene.tile_at.find(tile_key(x, z));
+				if(tile != scene.tile_at.end())
+					marked[tile->second] = 1;
+			}
+		}
+	}
+
+	draw_command commands[num_draws];
+	memcpy(commands, s.commands, sizeof(commands));
+	commands[DRAW_HINT].instanceCount = hinted;
+	GLintptr commands_offset = uniforms.alloc(sizeof(commands), &data);
+	memcpy(data, commands, sizeof(commands));
+	uniforms.flush();
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, frame_block, uniforms.buffer, frame_offset, 2*sizeof(glm::mat4));
+	glBindVertexArray(scene.VertexArrayID);
+	if(scene.indirect)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, uniforms.buffer);
+		glVertexAttribIPointer(3, 1, GL_UNSIGNED_BYTE, 1, (void*)flags_offset);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, uniforms.buffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (void*)commands_offset, num_draws, 0);
+	}
+	else
+	{
+		// GL 3.3 has no base instance, and its multi-draws are neither instanced
+		// nor tell the shader which draw it is in: one instanced draw per
+		// mesh, with the instance attributes pointed at its group. Every mesh
+		// is drawn, empty groups as zero instances, so a frame is always
+		// num_draws calls whatever tiles the level has.
+		for(int d = 0; d < num_draws; d++)
+		{
+			const draw_command &c = commands[d];
+			glBindBuffer(GL_ARRAY_BUFFER, scene.OffsetBuffer);
+			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)(c.baseInstance*sizeof(glm::vec3)));
+			glBindBuffer(GL_ARRAY_BUFFER, uniforms.buffer);
+			glVertexAttribIPointer(3, 1, GL_UNSIGNED_BYTE, 1, (void*)(flags_offset + c.baseInstance));
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, c.count, GL_UNSIGNED_SHORT, (void*)(c.firstIndex*sizeof(GLushort)), c.instanceCount, c.baseVertex);
+		}
+	}
+	glBindVertexArray(0);
+	uniforms.end_frame();
+}
+
+void report_latency ()
+{
+	latency.report();
+}
+
+/* One frame on a single thread: simulate, then render */
+void draw ()
+{
+	static frame_snapshot frame;
+	update(true);
+	capture(frame);
+	render(frame);
+}
+
+/* --render-thread: GL submission and buffer swaps run here, the main thread
+   keeps polling input and stepping the game at a fixed tick */
+thread render_thread;
+atomic<bool> render_stop(false);
+
+void render_loop (GLFWwindow* window)
+{
+	glfwMakeContextCurrent(window);
+	while (!render_stop)
+	{
+		render(snapshots.read_slot());
+		glfwSwapBuffers(window);
+		latency.present(frame_move_serial, glfwGetTime());
+	}
+	glfwMakeContextCurrent(NULL);
+}
+
+void start_render_thread (GLFWwindow* window)
+{
+	glfwMakeContextCurrent(NULL);
+	render_stop = false;
+	render_thread = thread(render_loop, window);
+}
+
+/* --inject-input: synthetic arrow key presses for unattended latency runs.
+   Every inject_interval seconds it presses a key whose move keeps the cuboid
+   on the board, and closes the window once every move has been presented. */
+int inject_moves = 0; // presses left
+const double inject_interval = 0.1;
+
+void inject_input (GLFWwindow* window)
+{
+	static double next_inject = 0;
+	static int turn = 0;
+	static const int keys[4] = { GLFW_KEY_LEFT, GLFW_KEY_RIGHT, GLFW_KEY_UP, GLFW_KEY_DOWN };
+
+	if (inject_moves == 0)
+	{
+		if (latency.presents == latency.inputs)
+			glfwSetWindowShouldClose(window, 1);
+		return;
+	}
+	double now = glfwGetTime();
+	if (now < next_inject || game_progress != 0 || !hints)
+		return;
+	next_inject = now + inject_interval;
+
+	pose p = current_pose();
+	turn++;
+	for (int k = 0; k < 4; k++)
+	{
+		int dir = (turn + k) % 4;
+		pose q = p;
+		if (step(hints->level, q, dir) == GAME_IN_PROGRESS)
+		{
+			keyboard(window, keys[dir], 0, GLFW_PRESS, 0);
+			inject_moves--;
+			return;
+		}
+	}
+}
+
+// hand the context back to the calling (main) thread
+void stop_render_thread (GLFWwindow* window)
+{
+	if (!render_thread.joinable())
+		return;
+	render_stop = true;
+	render_thread.join();
+	glfwMakeContextCurrent(window);
+}
+
+/* Hot reload: inotify watches on the directories holding the level files
+   and the shaders, polled by the main thread every frame. Editors often
+   save by renaming a new file over the old one, so directories are watched
+   and events are matched by file name. Elsewhere nothing is ever reported. */
+class file_watcher {
+	public:
+		int fd;
+		map<int, string> dirs; // watch descriptor -> directory
+
+		file_watcher()
+		{
+			fd = -1;
+		}
+
+		void watch(const string &dir)
+		{
+#ifdef __linux__
+			if (fd == -1)
+				fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			int wd = fd == -1 ? -1 : inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+			if (wd != -1)
+				dirs[wd] = dir;
+#endif
+		}
 
-	// TRIANGLE (DEFAULT)
-	glm::mat4 translateTriangle = glm::translate (glm::vec3(-2.0f, 0.0f, 0.0f)); // glTranslatef
-	glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-	glm::mat4 triangleTransform = translateTriangle * rotateTriangle;
-	Matrices.model *= triangleTransform; 
-	MVP = VP * Matrices.model; // MVP = p * V * M
+		// "dir/name" of every file changed since the last call
+		vector<string> poll()
+		{
+			vector<string> changed;
+#ifdef __linux__
+			char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+			ssize_t n;
+			while (fd != -1 && (n = read(fd, buffer, sizeof(buffer))) > 0)
+			{
+				for (char *p = buffer; p < buffer + n; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+				{
+					const inotify_event *e = (const inotify_event*)p;
+					if (e->len == 0 || !dirs.count(e->wd))
+						continue;
+					string path = dirs[e->wd] + "/" + e->name;
+					if (find(changed.begin(), changed.end(), path) == changed.end())
+						changed.push_back(path);
+				}
+			}
+#endif
+			return changed;
+		}
 
-	//  Don't change unless you are sure!!
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+		void stop()
+		{
+#ifdef __linux__
+			if (fd != -1)
+				close(fd);
+#endif
+			fd = -1;
+			dirs.clear();
+		}
+};
+file_watcher watcher;
+const string level_dir = "levels"; // text levels, as compiled into levels.pack
+string watched_pack; // pack the levels were loaded from, as the watcher names it
+bool watched_text = false; // the levels were compiled from level_dir, so its edits are picked up
 
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	// draw3DObject(triangle);
+// directory of a path, "." for a bare file name
+string dir_of (const string &path)
+{
+	size_t slash = path.rfind('/');
+	return slash == string::npos ? "." : path.substr(0, slash);
+}
 
-	// Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-	// glPopMatrix ();
-	Matrices.model = glm::mat4(1.0f);
+// from_text: the pack is the one made from level_dir, rather than one given with --levels
+void start_hot_reload (const string &pack, bool from_text)
+{
+	watched_pack = dir_of(pack) + "/" + pack.substr(pack.rfind('/') + 1);
+	watched_text = from_text;
+	watcher.watch("."); // shaders
+	if (watched_text)
+		watcher.watch(level_dir);
+	if (dir_of(pack) != ".")
+		watcher.watch(dir_of(pack));
+}
 
-	glm::mat4 translateRectangle = glm::translate (glm::vec3(2, 0, 0));        // glTranslatef
-	glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-	Matrices.model *= (translateRectangle * rotateRectangle);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+void stop_hot_reload ()
+{
+	watcher.stop();
+}
 
-	// draw3DObject draws the VAO given to it using current MVP matrix
-	// draw3DObject(rectangle);
+// every text level of a directory, in play order; false if any is broken
+bool read_level_dir (const string &dir, vector<level_def> &out)
+{
+	vector<string> files = list_level_files(dir);
+	vector<char> text;
+	out.resize(files.size());
+	for (int k = 0; k < files.size(); k++)
+	{
+		level_error error;
+		if (!read_text_file(files[k], text))
+			return false;
+		if (!parse_level(text.data(), text.size(), out[k], error)) {
+			cerr << files[k] << ":" << error.line << ": " << error.message << ", levels not reloaded" << endl;
+			return false;
+		}
+	}
+	return !files.empty();
+}
 
-	// Increment angles
-	float increments = 1;
+/* Pick up files edited since the last frame: the shaders are relinked by
+   the next render(), edited levels are swapped in right away */
+void hot_reload ()
+{
+	vector<string> changed = watcher.poll();
+	bool from_text = false, from_pack = false;
+	for (int k = 0; k < changed.size(); k++)
+	{
+		const string &path = changed[k];
+		if (path == "./Sample_GL.vert" || path == "./Sample_GL.frag")
+			shaders_changed = true;
+		else if (path == watched_pack)
+			from_pack = true;
+		else if (watched_text && path.compare(0, level_dir.size() + 1, level_dir + "/") == 0 && path.size() > 4 && path.compare(path.size() - 4, 4, ".txt") == 0)
+			from_text = true;
+	}
 
-	//camera_rotation_angle++; // Simulating camera rotation
-	triangle_rotation = triangle_rotation + increments*triangle_rot_dir*triangle_rot_status;
-	rectangle_rotation = rectangle_rotation + increments*rectangle_rot_dir*rectangle_rot_status;
+	vector<level_def> edited;
+	bool loaded = from_text && read_level_dir(level_dir, edited);
+	if (!loaded && from_pack) { // the pack may have been rebuilt even if a text level is broken
+		loaded = read_pack(watched_pack.c_str(), edited);
+		if (!loaded)
+			cerr << watched_pack << ": not a level pack, levels not reloaded" << endl;
+	}
+	if (!loaded)
+		return;
+	levels.swap(edited);
+	reload_level();
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
@@ -1455,16 +2657,16 @@ void initGL (GLFWwindow* window, int width, int height)
 {
 	/* Objects should be created before any other gl function and shaders */
 	// Create the models
-	createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
-	createRectangle ();
-
-	piece.create();
+	piece.create(); // Generate the vertices data of every mesh
 	createTiles();
+	createHint();
+	create_scene_buffers(); // one buffer for all of them
 	
 	// Create and compile our GLSL program from the shaders
 	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	// Bind the "Frame" uniform block (view projection and cuboid) to the ring
+	setup_program(programID);
+	uniforms.create(64*1024);
 
 	
 	reshapeWindow (window, width, height);
@@ -1483,30 +2685,218 @@ void initGL (GLFWwindow* window, int width, int height)
 	cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* Render benchmark: synthetic board of n tiles, scripted camera through all
+   five views, vsync off. Prints frames/sec and CPU/GPU ms per frame as JSON. */
+void bench_render(GLFWwindow* window, int n, int frames_per_mode)
+{
+	int w = (int)ceil(sqrt((double)n));
+	grid.clear();
+	grid.reserve(n);
+	for(int k = 0; k < n; k++)
+	{
+		int i = k / w, j = k % w;
+		int type = 1;
+		if(k == n - 1)
+			type = 5;
+		else if(k % 7 == 3)
+			type = 2 + (k / 7) % 3; // sprinkle fragile, bridge and switch tiles
+		if(abs(i - map_center_i) <= 2 && abs(j - map_center_j) <= 2)
+			type = 1; // keep the path of the cuboid solid
+		grid.add(i, j, type);
+		grid.show.back() = 1;
+	}
+	level_serial++;
+	build_draws();
+	game_progress = 0;
+	take_action = false;
+	piece.place(map_center_i, map_center_j);
+	state_hash = hash_state();
+
+	glfwSwapInterval(0);
+
+	const int num_queries = 4; // GPU timings are read back a few frames late
+	GLuint queries[num_queries];
+	glGenQueries(num_queries, queries);
+
+	int total = 5*frames_per_mode;
+	double cpu_ms[5] = { 0 }, gpu_ms[5] = { 0 }, wall[5] = { 0 };
+	double start = glfwGetTime();
+	for(int frame = 0; frame < total && !glfwWindowShouldClose(window); frame++)
+	{
+		int mode = frame / frames_per_mode;
+		double t = (double)(frame % frames_per_mode) / frames_per_mode;
+		if(cam.mode != mode)
+			cam.set_mode(mode, glfwGetTime(), false);
+		if(mode == 2 || mode == 3) // walk the cuboid back and forth across the solid patch
+		{
+			piece.place(map_center_i - 2 + (frame / 10) % 5, map_center_j);
+			state_hash = hash_state();
+		}
+		if(mode == 4) // circle the board in helicopter view
+			cam.set_orbit(8, 2*M_PI*t, 0.5 + 0.5*sin(2*M_PI*t));
+
+		if(frame >= num_queries)
+		{
+			GLuint64 elapsed;
+			glGetQueryObjectui64v(queries[frame % num_queries], GL_QUERY_RESULT, &elapsed);
+			gpu_ms[(frame - num_queries) / frames_per_mode] += elapsed / 1e6;
+		}
+
+		double frame_start = glfwGetTime();
+		glBeginQuery(GL_TIME_ELAPSED, queries[frame % num_queries]);
+		draw();
+		glEndQuery(GL_TIME_ELAPSED);
+		cpu_ms[mode] += (glfwGetTime() - frame_start) * 1000;
+
+		glfwSwapBuffers(window);
+		glfwPollEvents();
+		wall[mode] += glfwGetTime() - frame_start;
+	}
+	for(int frame = max(total - num_queries, 0); frame < total; frame++)
+	{
+		GLuint64 elapsed;
+		glGetQueryObjectui64v(queries[frame % num_queries], GL_QUERY_RESULT, &elapsed);
+		gpu_ms[frame / frames_per_mode] += elapsed / 1e6;
+	}
+	double seconds = glfwGetTime() - start;
+	glDeleteQueries(num_queries, queries);
+
+	const char *names[5] = { "tower", "top", "block", "follow", "helicopter" };
+	double cpu = 0, gpu = 0;
+	cout << "{\n  \"tiles\": " << n << ",\n  \"frames\": " << total << ",\n  \"modes\": [\n";
+	for(int mode = 0; mode < 5; mode++)
+	{
+		cpu += cpu_ms[mode];
+		gpu += gpu_ms[mode];
+		cout << "    { \"view\": \"" << names[mode] << "\""
+			<< ", \"fps\": " << frames_per_mode / wall[mode]
+			<< ", \"cpu_ms_per_frame\": " << cpu_ms[mode] / frames_per_mode
+			<< ", \"gpu_ms_per_frame\": " << gpu_ms[mode] / frames_per_mode << " }"
+			<< (mode < 4 ? "," : "") << "\n";
+	}
+	cout << "  ],\n  \"fps\": " << total / seconds
+		<< ",\n  \"cpu_ms_per_frame\": " << cpu / total
+		<< ",\n  \"gpu_ms_per_frame\": " << gpu / total << "\n}" << endl;
+}
+
 int main (int argc, char** argv)
 {
 	int width = 600;
 	int height = 600;
+	int bench_tiles = 0; // --bench-render [tiles]: run the render benchmark instead of the game
+	int bench_frames = 300; // --bench-frames n: frames spent in each camera mode
+	bool render_threaded = false; // --render-thread: render on a separate thread
+	string level_pack = "levels.pack"; // --levels file: pack compiled by levelc
+	bool pack_given = false;
+	string stats_log = "stats.log"; // --stats-log file: attempts of every session
+	string stats_socket = "stats.sock"; // --stats-socket path: where stats queries are answered
+	string session_log = "sessions.log"; // --session-log file: keys and results of every session
+	int undo_depth = 1000; // --undo-depth n: moves that can be undone
+
+	for(int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		if(arg == "--bench-render")
+		{
+			bench_tiles = 10000;
+			if(a + 1 < argc && isdigit(argv[a + 1][0]))
+				bench_tiles = atoi(argv[++a]);
+			bench_tiles = min(max(bench_tiles, 100), 1000000);
+		}
+		else if(arg == "--bench-frames" && a + 1 < argc)
+			bench_frames = max(atoi(argv[++a]), 1);
+		else if(arg == "--render-thread")
+			render_threaded = true;
+		else if(arg == "--levels" && a + 1 < argc)
+		{
+			level_pack = argv[++a];
+			pack_given = true;
+		}
+		else if(arg == "--stats-log" && a + 1 < argc)
+			stats_log = argv[++a];
+		else if(arg == "--stats-socket" && a + 1 < argc)
+			stats_socket = argv[++a];
+		else if(arg == "--session-log" && a + 1 < argc)
+			session_log = argv[++a];
+		else if(arg == "--undo-depth" && a + 1 < argc)
+			undo_depth = max(atoi(argv[++a]), 0);
+		else if(arg == "--inject-input")
+		{
+			inject_moves = 200;
+			if(a + 1 < argc && isdigit(argv[a + 1][0]))
+				inject_moves = max(atoi(argv[++a]), 1);
+		}
+	}
+
+	bool pack_loaded = read_pack(level_pack.c_str(), levels);
+	if(pack_loaded)
+		cout << "Loaded " << levels.size() << " levels from " << level_pack << endl;
+	else
+	{
+		if(pack_given)
+			cerr << level_pack << ": not a level pack, playing the built-in levels" << endl;
+		for(int k = 0; k < max_maps; k++)
+			levels.push_back(builtin_level(k));
+	}
 
 	GLFWwindow* window = initGLFW(width, height);
 
 	initGL (window, width, height);
 
+	if(bench_tiles > 0)
+	{
+		bench_render(window, bench_tiles, bench_frames);
+		quit(window);
+	}
+
 	double last_update_time = glfwGetTime(), current_time;
 
+	jobs.start();
+	start_hot_reload(level_pack, pack_loaded && !pack_given);
+	stats.start(stats_log, stats_socket);
+	session_start = glfwGetTime();
+	if(!session.open(session_log, time(NULL)))
+		cerr << session_log << ": cannot write the session log" << endl;
+	history.configure(undo_depth);
 	init_game();
 
+	if(render_threaded)
+	{
+		start_render_thread(window);
+		const double tick = 1.0/60; // the fall animation advances once per tick
+		double next_tick = glfwGetTime();
+		while (!glfwWindowShouldClose(window)) {
+			// wake up for input as soon as it arrives, so moves never wait on a swap
+			glfwWaitEventsTimeout(max(min(next_tick - glfwGetTime(), inject_interval), 0.0));
+			inject_input(window);
+			hot_reload();
+
+			current_time = glfwGetTime();
+			bool due = current_time >= next_tick;
+			if (due)
+				next_tick = max(next_tick + tick, current_time - tick);
+
+			update(due);
+			capture(snapshots.write_slot());
+			snapshots.publish();
+		}
+		stop_render_thread(window);
+	}
+
 	/* Draw in loop */
-	while (!glfwWindowShouldClose(window)) {
+	while (!render_threaded && !glfwWindowShouldClose(window)) {
 
 		// OpenGL Draw commands
 		draw();
 
 		// Swap Frame Buffer in double buffering
 		glfwSwapBuffers(window);
+		latency.present(frame_move_serial, glfwGetTime());
 
 		// Poll for Keyboard and mouse events
 		glfwPollEvents();
+		inject_input(window);
+		hot_reload();
 
 		// Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
 		current_time = glfwGetTime(); // Time in seconds
@@ -1516,6 +2906,10 @@ int main (int argc, char** argv)
 		}
 	}
 
+	report_latency();
+	jobs.stop();
+	stop_stats();
+	session.close();
 	glfwTerminate();
 	// exit(EXIT_SUCCESS);
 }
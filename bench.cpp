@@ -0,0 +1,336 @@
+#include <atomic>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "logic.h"
+#include "solver.h"
+#include "levels.h"
+#include "levelfile.h"
+#include "sessionlog.h"
+#include "simd.h"
+#include "jobs.h"
+#include "replay.h"
+
+using namespace std;
+
+/* Microbenchmarks of the game logic. Prints one JSON document on stdout so
+   results can be tracked across commits. Run with `make bench`. */
+
+const double min_bench_time = 0.5; // seconds each benchmark keeps repeating for
+
+struct bench_result {
+	string name;
+	long long ops;
+	double seconds;
+	long long checksum; // folded from the results so nothing is optimised away
+};
+vector<bench_result> results;
+
+double now()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// cheap deterministic move sequence
+unsigned next_random(unsigned &seed)
+{
+	seed = seed*1664525u + 1013904223u;
+	return seed >> 16;
+}
+
+/* Raw cuboid transitions, geometry only */
+void bench_roll()
+{
+	bench_result r = { "cuboid_move", 0, 0, 0 };
+	unsigned seed = 1;
+	pose p = load_level(0).start;
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		for (int k = 0; k < 1000000; k++)
+		{
+			p = roll(p, next_random(seed) & 3);
+			r.checksum += p.i + p.j + p.state;
+		}
+		r.ops += 1000000;
+	}
+	r.seconds = now() - start;
+	results.push_back(r);
+}
+
+/* Full moves with the tile rules, restarting the level when it ends */
+void bench_step(int level)
+{
+	bench_result r = { "step_with_rules/level" + to_string(level + 1), 0, 0, 0 };
+	board b = load_level(level);
+	unsigned seed = 1;
+	pose p = b.start;
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		for (int k = 0; k < 1000000; k++)
+		{
+			int outcome = step(b, p, next_random(seed) & 3);
+			r.checksum += outcome;
+			if (outcome != GAME_IN_PROGRESS)
+				p = b.start;
+		}
+		r.ops += 1000000;
+	}
+	r.seconds = now() - start;
+	results.push_back(r);
+}
+
+/* Level decoding: the headless half of init_grid */
+void bench_load()
+{
+	bench_result r = { "level_load", 0, 0, 0 };
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		for (int k = 0; k < 10000; k++)
+		{
+			board b = load_level(k % max_maps);
+			r.checksum += b.num_bridges + b.start.i;
+		}
+		r.ops += 10000;
+	}
+	r.seconds = now() - start;
+	results.push_back(r);
+}
+
+/* Text level parser, over the built-in levels written out as text */
+void bench_parse()
+{
+	bench_result r = { "level_parse", 0, 0, 0 };
+	string text[max_maps];
+	for (int k = 0; k < max_maps; k++)
+		text[k] = format_level(builtin_level(k));
+	level_def l;
+	level_error error;
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		for (int k = 0; k < 10000; k++)
+		{
+			const string &t = text[k % max_maps];
+			r.checksum += parse_level(t.data(), t.size(), l, error) + l.switches[0][0];
+		}
+		r.ops += 10000;
+	}
+	r.seconds = now() - start;
+	results.push_back(r);
+}
+
+/* Session log decoding, measured in bytes, over synthetic play: a move
+   every few ticks with the odd pause, results, restarts and new levels */
+void bench_session_decode()
+{
+	bench_result r = { "session_decode_bytes", 0, 0, 0 };
+	session_encoder encoder;
+	vector<unsigned char> log;
+	unsigned seed = 1, tick = 0;
+	encoder.add(SESSION_BEGIN, 0, 1700000000);
+	while (log.size() < (16 << 20))
+	{
+		unsigned roll = next_random(seed) % 64;
+		tick += next_random(seed) % (roll == 0 ? 600 : 30);
+		if (roll == 1)
+			encoder.add(next_random(seed) & 1 ? SESSION_SOLVED : SESSION_FELL, tick);
+		else if (roll == 2)
+		{
+			encoder.add(next_random(seed) % 3 + SESSION_RESET, tick);
+			encoder.add(SESSION_LEVEL, tick, next_random(seed) % max_maps);
+		}
+		else
+			encoder.add(SESSION_MOVE, tick, next_random(seed) & 3);
+		if (encoder.full())
+			encoder.finish(log);
+	}
+	encoder.finish(log);
+
+	vector<session_event> events(max_session_events);
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		for (size_t at = 0; at < log.size(); )
+		{
+			size_t count = 0, used = decode_session_block(&log[at], log.size() - at, &events[0], count);
+			if (used == 0)
+				break;
+			r.checksum += count + events[count - 1].tick;
+			at += used;
+		}
+		r.ops += log.size();
+	}
+	r.seconds = now() - start;
+	results.push_back(r);
+}
+
+/* Replays of random 40-move sequences against the level's table, as the
+   verify tool checks submissions; measured in sequences */
+void bench_replay(int level)
+{
+	bench_result r = { "replay/level" + to_string(level + 1), 0, 0, 0 };
+	replay_table t = build_replay_table(load_level(level));
+	unsigned seed = 1;
+	unsigned char moves[40];
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		for (int k = 0; k < 100000; k++)
+		{
+			for (int m = 0; m < 40; m++)
+				moves[m] = next_random(seed) & 3;
+			replay_result result = replay(t, moves, 40);
+			r.checksum += result.moves + result.outcome;
+		}
+		r.ops += 100000;
+	}
+	r.seconds = now() - start;
+	results.push_back(r);
+}
+
+/* BFS solvers, measured in expanded states */
+void bench_solve(int level, bool bidirectional)
+{
+	bench_result r = { (bidirectional ? "bidir_states/level" : "bfs_states/level") + to_string(level + 1), 0, 0, 0 };
+	board b = load_level(level);
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		solve_result s = bidirectional ? solve_bidirectional(b) : solve_bfs(b);
+		r.ops += s.expanded;
+		r.checksum += s.moves;
+	}
+	r.seconds = now() - start;
+	results.push_back(r);
+}
+
+/* Tile outcomes of a batch of random poses around the map, per kernel */
+void bench_batch(int level, bool wide)
+{
+	bench_result r = { string("batch_outcomes/") + (wide ? "avx2" : "scalar") + "/level" + to_string(level + 1), 0, 0, 0 };
+	board b = load_level(level);
+	const int n = 4096;
+	pose_batch batch;
+	batch.resize(n);
+	unsigned seed = 1;
+	for (int k = 0; k < n; k++)
+	{
+		pose p;
+		p.i = next_random(seed) % (b.rows + 2) - 1; // some off the map
+		p.j = next_random(seed) % (b.cols + 2) - 1;
+		p.state = next_random(seed) % 3;
+		p.bridges = next_random(seed) & ((1u << b.num_bridges) - 1);
+		batch.set(k, p);
+	}
+	vector<int> outcome(n);
+	if (wide) // the kernel has to agree with the rules it vectorizes
+	{
+		vector<int> expected(n);
+		tile_outcomes_scalar(b, batch, 0, n, expected.data());
+		tile_outcomes(b, batch, outcome.data());
+		if (outcome != expected)
+		{
+			cerr << "batch_outcomes: avx2 and scalar disagree on level " << level + 1 << endl;
+			exit(1);
+		}
+	}
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		for (int rep = 0; rep < 1000; rep++)
+		{
+			if (wide)
+				tile_outcomes(b, batch, outcome.data());
+			else
+				tile_outcomes_scalar(b, batch, 0, n, outcome.data());
+			r.checksum += outcome[rep % n];
+		}
+		for (int k = 0; k < n; k++)
+			r.checksum += outcome[k]*(k + 1);
+		r.ops += 1000LL*n;
+	}
+	r.seconds = now() - start;
+	results.push_back(r);
+}
+
+/* Job system throughput: root jobs submitted from the main thread each fan
+   out children onto their worker's deque for the idle workers to steal */
+job_system jobs;
+
+void bench_jobs()
+{
+	bench_result r = { "jobs", 0, 0, 0 };
+	const int roots = 64, children = 1000;
+	board b = load_level(0);
+	atomic<long long> done(0), checksum(0);
+	double start = now();
+	while (now() - start < min_bench_time)
+	{
+		long long target = done + roots*(children + 1LL);
+		for (int k = 0; k < roots; k++)
+			jobs.run([&, k]() {
+				for (int c = 0; c < children; c++)
+					jobs.run([&, c]() {
+						pose p = b.start;
+						int outcome = step(b, p, c & 3);
+						checksum += outcome + p.i;
+						done++;
+					});
+				done++;
+			});
+		jobs.help_until([&]() { return done >= target; });
+		r.ops += roots*(children + 1LL);
+	}
+	r.seconds = now() - start;
+	r.checksum = checksum;
+	results.push_back(r);
+}
+
+int main (int argc, char** argv)
+{
+	bench_roll();
+	for (int level = 0; level < max_maps; level++)
+		bench_step(level);
+	bench_load();
+	bench_parse();
+	bench_session_decode();
+	for (int level = 0; level < max_maps; level++)
+	{
+		bench_solve(level, false);
+		bench_solve(level, true);
+	}
+	for (int level = 0; level < max_maps; level++)
+		bench_replay(level);
+	for (int level = 0; level < max_maps; level++)
+	{
+		bench_batch(level, false);
+		if (have_avx2())
+			bench_batch(level, true);
+	}
+	jobs.start();
+	bench_jobs();
+	job_metrics m = jobs.metrics();
+	jobs.stop();
+
+	cout << "{\n  \"benchmarks\": [\n";
+	for (int k = 0; k < results.size(); k++)
+	{
+		cout << "    { \"name\": \"" << results[k].name << "\""
+			<< ", \"ops\": " << results[k].ops
+			<< ", \"seconds\": " << results[k].seconds
+			<< ", \"ops_per_sec\": " << (long long)(results[k].ops / results[k].seconds)
+			<< ", \"checksum\": " << results[k].checksum << " }"
+			<< (k + 1 < results.size() ? "," : "") << "\n";
+	}
+	cout << "  ],\n  \"jobs\": { \"workers\": " << jobs.size()
+		<< ", \"executed\": " << m.executed
+		<< ", \"steals\": " << m.steals
+		<< ", \"queue_depth\": " << m.queue_depth
+		<< ", \"max_queue_depth\": " << m.max_queue_depth << " }\n}" << endl;
+}
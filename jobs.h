@@ -0,0 +1,436 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**************************
+ * Job system             *
+ **************************/
+
+/* Work-stealing scheduler shared by the game and the offline tools. Every
+   worker owns a Chase-Lev deque: it pushes and pops at the bottom, idle
+   workers steal from the top. Threads that are not workers (the render loop
+   in main) submit into a bounded MPMC injection queue. Jobs only lock when
+   a worker has nothing to do and goes to sleep. */
+
+class job {
+	public:
+		std::function<void()> work;
+		std::atomic<int> dependencies; // unfinished jobs this one waits for, plus one until submitted
+		job *continuation; // job to release when this one is done, or null
+
+		job(const std::function<void()> &w) : work(w)
+		{
+			dependencies = 1;
+			continuation = nullptr;
+		}
+};
+
+/* Chase-Lev deque over a fixed ring (Le, Pop, Cohen, Zappa Nardelli, 2013) */
+class work_deque {
+	public:
+		static const long long capacity = 1 << 12;
+
+		work_deque()
+		{
+			top = 0;
+			bottom = 0;
+			for (int k = 0; k < capacity; k++)
+				slots[k] = nullptr;
+		}
+
+		// owner only; false when full
+		bool push(job *j)
+		{
+			long long b = bottom.load(std::memory_order_relaxed);
+			long long t = top.load(std::memory_order_acquire);
+			if (b - t >= capacity)
+				return false;
+			slots[b & (capacity - 1)].store(j, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		// owner only, newest first
+		job *pop()
+		{
+			long long b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			long long t = top.load(std::memory_order_relaxed);
+			if (t > b) // empty
+			{
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			job *j = slots[b & (capacity - 1)].load(std::memory_order_relaxed);
+			if (t == b) // last one, race the thieves for it
+			{
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					j = nullptr;
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+			return j;
+		}
+
+		// any thread, oldest first
+		job *steal()
+		{
+			long long t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			long long b = bottom.load(std::memory_order_acquire);
+			if (t >= b)
+				return nullptr;
+			job *j = slots[t & (capacity - 1)].load(std::memory_order_relaxed);
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				return nullptr; // lost to the owner or another thief
+			return j;
+		}
+
+	private:
+		std::atomic<long long> top;
+		char pad[64]; // keep the thieves' end and the owner's end on separate cache lines
+		std::atomic<long long> bottom;
+		std::atomic<job *> slots[capacity];
+};
+
+/* Bounded multi-producer multi-consumer queue (Vyukov) */
+class injection_queue {
+	public:
+		static const size_t capacity = 1 << 10;
+
+		injection_queue()
+		{
+			for (size_t k = 0; k < capacity; k++)
+				cells[k].sequence = k;
+			enqueue_pos = 0;
+			dequeue_pos = 0;
+		}
+
+		// false when full
+		bool push(job *j)
+		{
+			size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+			cell *c;
+			while (true)
+			{
+				c = &cells[pos & (capacity - 1)];
+				size_t sequence = c->sequence.load(std::memory_order_acquire);
+				ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+				if (diff == 0)
+				{
+					if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+			c->data = j;
+			c->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		// null when empty
+		job *pop()
+		{
+			size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+			cell *c;
+			while (true)
+			{
+				c = &cells[pos & (capacity - 1)];
+				size_t sequence = c->sequence.load(std::memory_order_acquire);
+				ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+				if (diff == 0)
+				{
+					if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return nullptr;
+				else
+					pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+			job *j = c->data;
+			c->sequence.store(pos + capacity, std::memory_order_release);
+			return j;
+		}
+
+	private:
+		struct cell {
+			std::atomic<size_t> sequence;
+			job *data;
+		};
+		cell cells[capacity];
+		std::atomic<size_t> enqueue_pos;
+		char pad[64];
+		std::atomic<size_t> dequeue_pos;
+};
+
+struct job_metrics {
+	long long submitted;
+	long long executed;
+	long long steals; // jobs taken from another worker's deque
+	int queue_depth; // jobs queued and not yet taken
+	int max_queue_depth;
+};
+
+class job_system {
+	public:
+		job_system()
+		{
+			workers = nullptr;
+			num_workers = 0;
+			stopping = false;
+			queued = 0;
+			max_queued = 0;
+			sleeping = 0;
+			submitted = 0;
+			main_executed = 0;
+			main_steals = 0;
+			steal_seed = 12345;
+		}
+
+		~job_system()
+		{
+			stop();
+		}
+
+		// n worker threads, 0 = one per core less the main thread
+		void start(int n = 0)
+		{
+			if (workers)
+				return;
+			if (n <= 0)
+				n = std::max((int)std::thread::hardware_concurrency() - 1, 1);
+			num_workers = n;
+			stopping = false;
+			workers = new worker[n];
+			for (int k = 0; k < n; k++)
+				workers[k].thread = std::thread(&job_system::work_loop, this, k);
+		}
+
+		// join the workers; jobs still queued are dropped
+		void stop()
+		{
+			if (!workers)
+				return;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (int k = 0; k < num_workers; k++)
+				workers[k].thread.join();
+
+			job *j;
+			for (int k = 0; k < num_workers; k++)
+				while ((j = workers[k].deque.pop()))
+					delete j;
+			while ((j = injection.pop()))
+				delete j;
+			delete[] workers;
+			workers = nullptr;
+			queued = 0;
+		}
+
+		// a job that runs once submitted and once every job it follows is done
+		job *create(const std::function<void()> &work)
+		{
+			return new job(work);
+		}
+
+		// run 'next' after 'first'; before either is submitted
+		void then(job *first, job *next)
+		{
+			first->continuation = next;
+			next->dependencies++;
+		}
+
+		void submit(job *j)
+		{
+			if (--j->dependencies == 0)
+				enqueue(j);
+		}
+
+		void run(const std::function<void()> &work)
+		{
+			submit(create(work));
+		}
+
+		/* Run jobs on the calling thread until done() holds; for tools that
+		   wait on their own work instead of rendering */
+		void help_until(const std::function<bool()> &done)
+		{
+			while (!done())
+			{
+				job *j = find_work(-1);
+				if (j)
+					execute(j, -1);
+				else
+					std::this_thread::yield();
+			}
+		}
+
+		int size() const
+		{
+			return num_workers;
+		}
+
+		job_metrics metrics() const
+		{
+			job_metrics m;
+			m.submitted = submitted;
+			m.executed = main_executed;
+			m.steals = main_steals;
+			for (int k = 0; k < num_workers; k++)
+			{
+				m.executed += workers[k].executed;
+				m.steals += workers[k].steals;
+			}
+			m.queue_depth = queued;
+			m.max_queue_depth = max_queued;
+			return m;
+		}
+
+	private:
+		struct worker {
+			work_deque deque;
+			std::atomic<long long> executed, steals;
+			unsigned seed; // victim selection
+			std::thread thread;
+
+			worker()
+			{
+				executed = 0;
+				steals = 0;
+				seed = 0;
+			}
+		};
+
+		worker *workers;
+		int num_workers;
+		injection_queue injection;
+		std::atomic<int> queued, max_queued, sleeping;
+		std::atomic<long long> submitted, main_executed, main_steals;
+		std::mutex lock; // only taken to sleep and to wake sleepers
+		std::condition_variable wake;
+		std::atomic<bool> stopping;
+		unsigned steal_seed; // victim selection for threads that are not workers
+
+		// index of the calling thread's worker in this system, -1 for other threads
+		int current_worker()
+		{
+			return current_owner() == this ? current_index() : -1;
+		}
+
+		static job_system *&current_owner()
+		{
+			static thread_local job_system *owner = nullptr;
+			return owner;
+		}
+
+		static int &current_index()
+		{
+			static thread_local int index = -1;
+			return index;
+		}
+
+		void enqueue(job *j)
+		{
+			submitted++;
+			int depth = ++queued;
+			int seen = max_queued;
+			while (depth > seen && !max_queued.compare_exchange_weak(seen, depth))
+				;
+
+			int self = current_worker();
+			if (!workers || !((self != -1 && workers[self].deque.push(j)) || injection.push(j)))
+			{
+				// no workers, or every queue is full: run it here rather than block
+				queued--;
+				execute(j, self);
+				return;
+			}
+
+			// pairs with the sleeping/queued check in work_loop()
+			if (sleeping > 0)
+			{
+				std::lock_guard<std::mutex> guard(lock);
+			}
+			wake.notify_one();
+		}
+
+		job *find_work(int self)
+		{
+			job *j = nullptr;
+			if (self != -1)
+				j = workers[self].deque.pop();
+			if (!j)
+				j = injection.pop();
+			for (int tries = 0; !j && tries < 2*num_workers; tries++)
+			{
+				unsigned &seed = self != -1 ? workers[self].seed : steal_seed;
+				seed = seed*1664525u + 1013904223u;
+				int victim = (seed >> 16) % num_workers;
+				if (victim == self)
+					continue;
+				j = workers[victim].deque.steal();
+				if (j)
+				{
+					if (self != -1)
+						workers[self].steals++;
+					else
+						main_steals++;
+				}
+			}
+			if (j)
+				queued--;
+			return j;
+		}
+
+		void execute(job *j, int self)
+		{
+			j->work();
+			if (self != -1)
+				workers[self].executed++;
+			else
+				main_executed++;
+			job *next = j->continuation;
+			delete j;
+			if (next && --next->dependencies == 0)
+				enqueue(next);
+		}
+
+		void work_loop(int self)
+		{
+			current_owner() = this;
+			current_index() = self;
+			workers[self].seed = self*2654435761u + 1;
+			while (!stopping)
+			{
+				job *j = find_work(self);
+				if (j)
+				{
+					execute(j, self);
+					continue;
+				}
+				std::unique_lock<std::mutex> guard(lock);
+				sleeping++;
+				wake.wait(guard, [this]() { return stopping || queued > 0; });
+				sleeping--;
+			}
+		}
+
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "logic.h"
+#include "solver.h"
+#include "levels.h"
+#include "levelfile.h"
+#include "solvecache.h"
+
+using namespace std;
+
+/* Level compiler: turns text levels into the pack the game loads.
+
+       levelc [-o levels.pack] [-c levelc.cache] <directory or .txt file>...
+
+   Directories contribute their .txt files in name order. Every level is
+   parsed and solved; nothing is written if any of them fails. Solution
+   lengths are kept in the cache file between runs, so only levels that
+   changed since are solved again. */
+
+int main (int argc, char** argv)
+{
+	string output = "levels.pack", cache_file = "levelc.cache";
+	vector<string> files;
+	for (int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		struct stat info;
+		if (arg == "-o" && a + 1 < argc)
+			output = argv[++a];
+		else if (arg == "-c" && a + 1 < argc)
+			cache_file = argv[++a];
+		else if (stat(arg.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+		{
+			vector<string> found = list_level_files(arg);
+			files.insert(files.end(), found.begin(), found.end());
+		}
+		else
+			files.push_back(arg);
+	}
+	if (files.empty())
+	{
+		cerr << "usage: levelc [-o levels.pack] [-c levelc.cache] <directory or .txt file>..." << endl;
+		return 2;
+	}
+
+	solve_cache cache;
+	cache.load(cache_file);
+	vector<level_def> levels(files.size());
+	vector<char> text; // reused for every file
+	int errors = 0;
+	for (int k = 0; k < files.size(); k++)
+	{
+		level_error error;
+		if (!read_text_file(files[k], text))
+		{
+			cerr << files[k] << ": cannot read" << endl;
+			errors++;
+			continue;
+		}
+		if (!parse_level(text.data(), text.size(), levels[k], error))
+		{
+			cerr << files[k];
+			if (error.line > 0)
+				cerr << ":" << error.line;
+			cerr << ": " << error.message << endl;
+			errors++;
+			continue;
+		}
+		int moves = cached_solve(cache, load_level(levels[k]));
+		if (moves == -1)
+		{
+			cerr << files[k] << ": unsolvable" << endl;
+			errors++;
+			continue;
+		}
+		cout << files[k] << ": " << moves << " moves" << endl;
+	}
+
+	if (!cache.save(cache_file))
+		cerr << "levelc: cannot write " << cache_file << endl;
+	if (errors > 0)
+	{
+		cerr << "levelc: " << errors << " of " << files.size() << " levels failed, " << output << " not written" << endl;
+		return 1;
+	}
+	if (!write_pack(output.c_str(), levels))
+	{
+		cerr << "levelc: cannot write " << output << endl;
+		return 1;
+	}
+	cout << "levelc: " << levels.size() << " levels written to " << output << " (" << cache.misses << " solved, " << cache.hits << " from " << cache_file << ")" << endl;
+	return 0;
+}
@@ -0,0 +1,269 @@
+#ifndef LEVELFILE_H
+#define LEVELFILE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include "levels.h"
+
+/**************************
+ * Level files            *
+ **************************/
+
+/* Text levels for authoring, and the binary pack levelc compiles them into.
+
+   A text level is the map matrix, one row per line, one character per cell:
+       .  no tile       o  regular       S  regular, the brick starts here
+       F  fragile       B  bridge        W  switch       G  goal
+   Rows may be shorter than the map; missing cells are empty. The rows are
+   followed by one line per switch, with its cell and then the cells of the
+   bridges it toggles, each as "row column":
+       switch 4 2: 6 4, 6 5
+   Blank lines and lines starting with ';' are ignored. */
+
+struct level_error {
+	int line; // 1-based, 0 = the level as a whole
+	const char *message;
+};
+
+inline bool level_fail(level_error &error, int line, const char *message)
+{
+	error.line = line;
+	error.message = message;
+	return false;
+}
+
+/* Parse a text level into l in one pass over text, without allocating.
+   Stops at the first problem and describes it in error. */
+inline bool parse_level(const char *text, size_t size, level_def &l, level_error &error)
+{
+	memset(l.cells, 0, sizeof(l.cells));
+	memset(l.switches, -1, sizeof(l.switches));
+	int rows = 0, num_switches = 0, starts = 0, goals = 0, line = 0;
+	const char *p = text, *end = text + size;
+
+	while (p < end)
+	{
+		line++;
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		const char *last = eol;
+		while (last > p && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t'))
+			last--;
+
+		if (p == last || *p == ';')
+			;
+		else if (last - p >= 6 && memcmp(p, "switch", 6) == 0)
+		{
+			int values[max_switch_size], count = 0;
+			for (const char *q = p + 6; q < last; )
+			{
+				if (*q >= '0' && *q <= '9')
+				{
+					int v = 0;
+					for (; q < last && *q >= '0' && *q <= '9'; q++)
+						v = v < max_map_size ? v*10 + (*q - '0') : v;
+					if (v >= max_map_size)
+						return level_fail(error, line, "cell outside the map");
+					if (count == max_switch_size)
+						return level_fail(error, line, "switch toggles too many bridges");
+					values[count++] = v;
+				}
+				else if (*q == ' ' || *q == '\t' || *q == ':' || *q == ',')
+					q++;
+				else
+					return level_fail(error, line, "unexpected character in switch line");
+			}
+			if (count < 4 || count % 2)
+				return level_fail(error, line, "switch needs its cell and at least one bridge cell");
+			if (num_switches == max_switches)
+				return level_fail(error, line, "too many switches");
+			if (l.cells[values[0]][values[1]] != TILE_SWITCH)
+				return level_fail(error, line, "switch cell is not a W tile");
+			for (int k = 0; k < count; k++)
+			{
+				if (k >= 2 && k % 2 == 0 && l.cells[values[k]][values[k + 1]] != TILE_BRIDGE)
+					return level_fail(error, line, "bridge cell is not a B tile");
+				l.switches[num_switches][k] = values[k];
+			}
+			num_switches++;
+		}
+		else
+		{
+			if (num_switches > 0)
+				return level_fail(error, line, "map row after a switch line");
+			if (rows == max_map_size)
+				return level_fail(error, line, "too many map rows");
+			if (last - p > max_map_size)
+				return level_fail(error, line, "map row too long");
+			for (int j = 0; j < last - p; j++)
+			{
+				signed char &cell = l.cells[rows][j];
+				switch (p[j])
+				{
+					case '.': cell = TILE_EMPTY; break;
+					case 'o': cell = TILE_REGULAR; break;
+					case 'S': cell = -1; starts++; break;
+					case 'F': cell = TILE_FRAGILE; break;
+					case 'B': cell = TILE_BRIDGE; break;
+					case 'W': cell = TILE_SWITCH; break;
+					case 'G': cell = TILE_GOAL; goals++; break;
+					default:
+						return level_fail(error, line, "unknown tile character");
+				}
+			}
+			rows++;
+		}
+		p = eol + 1;
+	}
+
+	if (rows == 0)
+		return level_fail(error, 0, "no map rows");
+	if (starts != 1)
+		return level_fail(error, 0, "needs exactly one start (S)");
+	if (goals == 0)
+		return level_fail(error, 0, "has no goal (G)");
+	return true;
+}
+
+/* Text of a level, as parse_level reads it back */
+inline std::string format_level(const level_def &l)
+{
+	static const char tiles[] = "S.oFBWG"; // by cell value + 1
+	std::string text;
+	for (int i = 0; i < max_map_size; i++)
+	{
+		for (int j = 0; j < max_map_size; j++)
+			text += tiles[l.cells[i][j] + 1];
+		text += '\n';
+	}
+	for (int a = 0; a < max_switches; a++)
+	{
+		if (l.switches[a][0] == -1)
+			continue;
+		text += "switch " + std::to_string(l.switches[a][0]) + " " + std::to_string(l.switches[a][1]) + ":";
+		for (int b = 2; b + 1 < max_switch_size && l.switches[a][b] != -1; b += 2)
+			text += (b > 2 ? ", " : " ") + std::to_string(l.switches[a][b]) + " " + std::to_string(l.switches[a][b + 1]);
+		text += '\n';
+	}
+	return text;
+}
+
+/* Level pack: the magic "BLXP", a format version byte, three reserved bytes,
+   the level count as 32 bits little endian, then the levels as level_def.
+   Every field is a byte, so the pack reads the same on any machine. */
+const char pack_magic[4] = { 'B', 'L', 'X', 'P' };
+const int pack_version = 1;
+const unsigned max_pack_levels = 1 << 16;
+static_assert(sizeof(level_def) == max_map_size*max_map_size + max_switches*max_switch_size, "level_def has no padding");
+
+inline bool write_pack(const char *path, const std::vector<level_def> &levels)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return false;
+	unsigned n = levels.size();
+	unsigned char header[12] = { 0 };
+	memcpy(header, pack_magic, 4);
+	header[4] = pack_version;
+	for (int k = 0; k < 4; k++)
+		header[8 + k] = n >> (8*k);
+	bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header)
+		&& (n == 0 || fwrite(&levels[0], sizeof(level_def), n, f) == n);
+	return fclose(f) == 0 && ok;
+}
+
+// false when the file is missing or not a valid pack of this version; levels is then untouched
+/* A switch table as parse_level leaves it: each switch in use on a W tile
+   of the map, toggling one or more B tiles, and -1 past its last cell */
+inline bool valid_switches(const level_def &l)
+{
+	for (int a = 0; a < max_switches; a++)
+	{
+		const signed char *entry = l.switches[a];
+		int cells = 0; // the switch, then its bridges
+		while (cells < max_switch_size/2 && entry[2*cells] != -1)
+			cells++;
+		for (int k = 2*cells; k < max_switch_size; k++)
+			if (entry[k] != -1)
+				return false;
+		if (cells == 1)
+			return false;
+		for (int k = 0; k < cells; k++)
+		{
+			int i = entry[2*k], j = entry[2*k + 1];
+			if (i < 0 || i >= max_map_size || j < 0 || j >= max_map_size)
+				return false;
+			if (l.cells[i][j] != (k == 0 ? TILE_SWITCH : TILE_BRIDGE))
+				return false;
+		}
+	}
+	return true;
+}
+
+inline bool read_pack(const char *path, std::vector<level_def> &levels)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+	unsigned char header[12];
+	bool ok = fread(header, 1, sizeof(header), f) == sizeof(header)
+		&& memcmp(header, pack_magic, 4) == 0 && header[4] == pack_version;
+	unsigned n = 0;
+	for (int k = 0; ok && k < 4; k++)
+		n |= (unsigned)header[8 + k] << (8*k);
+	ok = ok && n > 0 && n <= max_pack_levels;
+	std::vector<level_def> read(ok ? n : 0);
+	ok = ok && fread(&read[0], sizeof(level_def), n, f) == n;
+	fclose(f);
+	for (unsigned k = 0; ok && k < n; k++)
+	{
+		const signed char *cells = &read[k].cells[0][0];
+		for (int c = 0; c < max_map_size*max_map_size; c++)
+			ok = ok && cells[c] >= -1 && cells[c] <= TILE_GOAL;
+		ok = ok && valid_switches(read[k]);
+	}
+	if (ok)
+		levels.swap(read);
+	return ok;
+}
+
+// .txt files of a directory, sorted by name: the order levels are played in
+inline std::vector<std::string> list_level_files(const std::string &dir)
+{
+	std::vector<std::string> files;
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+		return files;
+	while (dirent *e = readdir(d))
+	{
+		std::string name = e->d_name;
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0)
+			files.push_back(dir + "/" + name);
+	}
+	closedir(d);
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+inline bool read_text_file(const std::string &path, std::vector<char> &text)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	text.clear();
+	char chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		text.insert(text.end(), chunk, chunk + n);
+	fclose(f);
+	return true;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+/* Built-in levels, shared by the game and the offline tools */
+
+#include "logic.h"
+
+const int map_center_i = 5;
+const int map_center_j = 5;
+const int max_map_size = 10;
+const int max_maps = 2; // built-in levels; a level pack may hold any number
+
+// -1 indicates where the brick starts
+const int maps[max_maps][max_map_size][max_map_size] =
+{
+	{
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{ 0, 0, 0, 0, 0, 0, 1, 1, 1, 1},
+		{ 1, 1, 1, 1, 0, 0, 1, 1, 5, 1},
+		{ 1, 1, 4, 1, 0, 0, 1, 1, 1, 1},
+		{ 1, 1, 1, 1, 0, 0, 1, 1, 1, 1},
+		{ 1,-1, 1, 1, 3, 3, 1, 1, 1, 1},
+		{ 1, 1, 1, 1, 0, 0, 1, 1, 1, 1},
+		{ 2, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+	},
+	{
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{ 0, 0, 0, 0, 0, 0, 1, 1, 1, 1},
+		{ 1, 1, 1, 1, 0, 0, 1, 1, 5, 1},
+		{ 1, 1, 4, 1, 0, 0, 1, 1, 1, 1},
+		{ 1, 1, 1, 1, 0, 0, 1, 1, 1, 1},
+		{ 1,-1, 1, 1, 3, 3, 1, 1, 1, 1},
+		{ 1, 1, 1, 1, 0, 0, 1, 1, 1, 1},
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+	},
+};
+
+// first two numbers indicate switch indices; the rest pairwise tell the bridge indices
+const int max_switches = 2;
+const int max_switch_size = 10;
+const int switches[max_maps][max_switches][max_switch_size] =
+{
+	{
+		{ 4, 2, 6, 4, 6, 5,-1,-1,-1,-1},
+		{-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
+	},
+	{
+		{ 4, 2, 6, 4, 6, 5,-1,-1,-1,-1},
+		{-1,-1,-1,-1,-1,-1,-1,-1,-1,-1},
+	},
+};
+
+/* Board of a built-in level */
+inline board load_level(int ind)
+{
+	return make_board(&maps[ind][0][0], max_map_size, max_map_size, &switches[ind][0][0], max_switches, max_switch_size);
+}
+
+/* A level in the layout of maps and switches, one byte per entry. This is
+   how the game holds its levels and how they are stored in a level pack. */
+struct level_def {
+	signed char cells[max_map_size][max_map_size];
+	signed char switches[max_switches][max_switch_size];
+};
+
+inline level_def builtin_level(int ind)
+{
+	level_def l;
+	for (int i = 0; i < max_map_size; i++)
+		for (int j = 0; j < max_map_size; j++)
+			l.cells[i][j] = maps[ind][i][j];
+	for (int a = 0; a < max_switches; a++)
+		for (int b = 0; b < max_switch_size; b++)
+			l.switches[a][b] = switches[ind][a][b];
+	return l;
+}
+
+inline board load_level(const level_def &l)
+{
+	int cells[max_map_size*max_map_size], table[max_switches*max_switch_size];
+	for (int c = 0; c < max_map_size*max_map_size; c++)
+		cells[c] = l.cells[c / max_map_size][c % max_map_size];
+	for (int c = 0; c < max_switches*max_switch_size; c++)
+		table[c] = l.switches[c / max_switch_size][c % max_switch_size];
+	return make_board(cells, max_map_size, max_map_size, table, max_switches, max_switch_size);
+}
+
+#endif
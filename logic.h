@@ -0,0 +1,276 @@
+#ifndef LOGIC_H
+#define LOGIC_H
+
+#include <vector>
+
+/**************************
+ * Headless game rules    *
+ **************************/
+
+/* The same rules draw() applies to the grid, on plain integers so they can be
+   run without a window by the hint engine and the offline tools. Cells are
+   addressed by map matrix coordinates (i, j) like the tiles class. */
+
+// move directions, as passed to cuboid::move
+enum { MOVE_LEFT = 0, MOVE_RIGHT = 1, MOVE_UP = 2, MOVE_DOWN = 3 };
+
+// tile types, as stored in maps
+enum { TILE_EMPTY = 0, TILE_REGULAR = 1, TILE_FRAGILE = 2, TILE_BRIDGE = 3, TILE_SWITCH = 4, TILE_GOAL = 5 };
+
+// outcomes, same values as game_progress
+enum { GAME_LOST = -1, GAME_IN_PROGRESS = 0, GAME_WON = 1 };
+
+struct pose {
+	int i, j; // map coordinates of cube one (the lower i / lower j cell)
+	int state; // 0 = along x, 1 = along y (standing), 2 = along z; as in cuboid
+	unsigned bridges; // bit b set = bridge b shown
+};
+
+class board {
+	public:
+		int rows, cols;
+		std::vector<int> type; // rows*cols tile types, 0 = no tile
+		std::vector<int> bridge_bit; // bit in pose::bridges for bridge tiles toggled by a switch, -1 otherwise
+		std::vector<unsigned> toggles; // bridges flipped when a switch tile gets pressed
+		int num_bridges;
+		pose start;
+
+		board()
+		{
+			rows = cols = 0;
+			num_bridges = 0;
+			start.i = start.j = 0;
+			start.state = 1;
+			start.bridges = 0;
+		}
+
+		// index into type, or -1 when (i, j) is off the map
+		int cell(int i, int j) const
+		{
+			if (i < 0 || j < 0 || i >= rows || j >= cols)
+				return -1;
+			return i*cols + j;
+		}
+};
+
+/* Build a board from a map matrix and its switch table (see maps and switches) */
+inline board make_board(const int *cells, int rows, int cols, const int *switch_table, int num_switches, int switch_size)
+{
+	board b;
+	b.rows = rows;
+	b.cols = cols;
+	b.type.assign(rows*cols, TILE_EMPTY);
+	b.bridge_bit.assign(rows*cols, -1);
+	b.toggles.assign(rows*cols, 0);
+
+	for (int c = 0; c < rows*cols; c++)
+	{
+		if (cells[c] == -1) // the brick starts standing on a regular tile
+		{
+			b.type[c] = TILE_REGULAR;
+			b.start.i = c / cols;
+			b.start.j = c % cols;
+		}
+		else
+			b.type[c] = cells[c];
+	}
+
+	for (int a = 0; a < num_switches; a++)
+	{
+		const int *entry = switch_table + a*switch_size;
+		int s = b.cell(entry[0], entry[1]);
+		if (s == -1)
+			continue;
+		for (int k = 2; k + 1 < switch_size; k += 2)
+		{
+			int c = b.cell(entry[k], entry[k + 1]);
+			if (c == -1 || b.type[c] != TILE_BRIDGE)
+				continue;
+			if (b.bridge_bit[c] == -1)
+				b.bridge_bit[c] = b.num_bridges++;
+			b.toggles[s] ^= 1u << b.bridge_bit[c];
+		}
+	}
+	return b;
+}
+
+/* Cells covered by the two cubes of the cuboid */
+inline void cube_cells(const pose &p, int &i2, int &j2)
+{
+	i2 = p.i + (p.state == 0);
+	j2 = p.j + (p.state == 2);
+}
+
+/* What one roll does to the cuboid for a (direction, state) pair */
+struct transition {
+	int state; // state after the roll
+	int di, dj; // shift of cube one, in map cells
+	int dx, dy, dz; // shift of the centre, in half sides
+	int rotation[3][3]; // quarter turn, row major, applied on the left
+};
+
+/* Derive a table entry from the roll direction. Left/right roll about the
+   z axis along i (x), up/down about the x axis along j (-z). */
+constexpr transition make_transition(int dir, int state)
+{
+	transition t = { 0, 0, 0, 0, 0, 0, { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } } };
+	bool along_i = (dir == MOVE_LEFT || dir == MOVE_RIGHT);
+	int sign = (dir == MOVE_RIGHT || dir == MOVE_UP) ? 1 : -1; // towards higher i / j
+	int lying = along_i ? 0 : 2; // state lying in the roll direction
+	int shift = 0, half = 0;
+
+	if (state == lying) // tips up onto its far end
+	{
+		t.state = 1;
+		shift = sign > 0 ? 2 : -1;
+		half = 3;
+		t.dy = 1;
+	}
+	else if (state == 1) // falls over
+	{
+		t.state = lying;
+		shift = sign > 0 ? 1 : -2;
+		half = 3;
+		t.dy = -1;
+	}
+	else // rolls on its long side
+	{
+		t.state = state;
+		shift = sign;
+		half = 2;
+	}
+
+	if (along_i)
+	{
+		t.di = shift;
+		t.dx = sign*half;
+		// +90 degrees about z for left, -90 for right
+		t.rotation[0][1] = sign;
+		t.rotation[1][0] = -sign;
+		t.rotation[2][2] = 1;
+	}
+	else
+	{
+		t.dj = shift;
+		t.dz = -sign*half;
+		// -90 degrees about x for up, +90 for down
+		t.rotation[0][0] = 1;
+		t.rotation[1][2] = sign;
+		t.rotation[2][1] = -sign;
+	}
+	return t;
+}
+
+constexpr transition transitions[4][3] = {
+	{ make_transition(MOVE_LEFT, 0), make_transition(MOVE_LEFT, 1), make_transition(MOVE_LEFT, 2) },
+	{ make_transition(MOVE_RIGHT, 0), make_transition(MOVE_RIGHT, 1), make_transition(MOVE_RIGHT, 2) },
+	{ make_transition(MOVE_UP, 0), make_transition(MOVE_UP, 1), make_transition(MOVE_UP, 2) },
+	{ make_transition(MOVE_DOWN, 0), make_transition(MOVE_DOWN, 1), make_transition(MOVE_DOWN, 2) },
+};
+
+static_assert(transitions[MOVE_LEFT][1].state == 0 && transitions[MOVE_LEFT][1].di == -2, "standing cuboid falls over to the left");
+static_assert(transitions[MOVE_UP][2].state == 1 && transitions[MOVE_UP][2].dj == 2 && transitions[MOVE_UP][2].dz == -3, "cuboid along z stands up going up");
+
+/* Roll the cuboid one step, geometry only: a single table load */
+inline pose roll(pose p, int dir)
+{
+	const transition &t = transitions[dir][p.state];
+	p.i += t.di;
+	p.j += t.dj;
+	p.state = t.state;
+	return p;
+}
+
+/* Same, with the direction fixed at compile time */
+template <int dir> inline pose roll(pose p)
+{
+	const transition &t = transitions[dir][p.state];
+	p.i += t.di;
+	p.j += t.dj;
+	p.state = t.state;
+	return p;
+}
+
+inline bool covers(const pose &p, int i, int j)
+{
+	int i2, j2;
+	cube_cells(p, i2, j2);
+	return (p.i == i && p.j == j) || (i2 == i && j2 == j);
+}
+
+inline bool supports(const board &b, int c, unsigned bridges)
+{
+	if (c == -1)
+		return false;
+	if (b.type[c] == TILE_BRIDGE)
+		return b.bridge_bit[c] != -1 && ((bridges >> b.bridge_bit[c]) & 1);
+	return b.type[c] != TILE_EMPTY;
+}
+
+/* Outcome of resting in a pose whose switches have already been applied:
+   both cells supported, not standing on fragile, standing on the goal wins */
+inline int tile_outcome(const board &b, const pose &p)
+{
+	int i2, j2;
+	cube_cells(p, i2, j2);
+	int c1 = b.cell(p.i, p.j);
+	int c2 = b.cell(i2, j2);
+
+	if (!supports(b, c1, p.bridges) || !supports(b, c2, p.bridges))
+		return GAME_LOST;
+	if (p.state == 1 && b.type[c1] == TILE_FRAGILE) // breaking condition
+		return GAME_LOST;
+	if (p.state == 1 && b.type[c1] == TILE_GOAL)
+		return GAME_WON;
+	return GAME_IN_PROGRESS;
+}
+
+/* Flip the bridges of the switches a move from 'from' presses in 'to' */
+inline void press_switches(const board &b, const pose &from, pose &to)
+{
+	int i2, j2;
+	cube_cells(to, i2, j2);
+	int c1 = b.cell(to.i, to.j);
+	int c2 = b.cell(i2, j2);
+
+	if (c1 != -1 && b.type[c1] == TILE_SWITCH && !covers(from, to.i, to.j))
+		to.bridges ^= b.toggles[c1];
+	if (c2 != -1 && c2 != c1 && b.type[c2] == TILE_SWITCH && !covers(from, i2, j2))
+		to.bridges ^= b.toggles[c2];
+}
+
+/* Apply the tile rules to a pose reached from 'from' and return the outcome.
+   Switches pressed by the move flip their bridges before support is checked. */
+inline int apply_rules(const board &b, const pose &from, pose &to)
+{
+	press_switches(b, from, to);
+	return tile_outcome(b, to);
+}
+
+/* One full move: roll, then the tile rules. Returns the outcome. */
+inline int step(const board &b, pose &p, int dir)
+{
+	pose from = p;
+	p = roll(p, dir);
+	return apply_rules(b, from, p);
+}
+
+template <int dir> inline int step(const board &b, pose &p)
+{
+	pose from = p;
+	p = roll<dir>(p);
+	return apply_rules(b, from, p);
+}
+
+/* All four moves from p, as step would make them, for the searches that
+   try every direction: to[dir] and the outcome of each */
+inline void step_all(const board &b, const pose &p, pose to[4], int outcomes[4])
+{
+	to[MOVE_LEFT] = to[MOVE_RIGHT] = to[MOVE_UP] = to[MOVE_DOWN] = p;
+	outcomes[MOVE_LEFT] = step<MOVE_LEFT>(b, to[MOVE_LEFT]);
+	outcomes[MOVE_RIGHT] = step<MOVE_RIGHT>(b, to[MOVE_RIGHT]);
+	outcomes[MOVE_UP] = step<MOVE_UP>(b, to[MOVE_UP]);
+	outcomes[MOVE_DOWN] = step<MOVE_DOWN>(b, to[MOVE_DOWN]);
+}
+
+#endif
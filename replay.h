@@ -0,0 +1,114 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstddef>
+#include <vector>
+
+#include "logic.h"
+#include "solver.h"
+#include "simd.h"
+
+/**************************
+ * Replays                *
+ **************************/
+
+/* Checking that a move sequence really plays out on a level, for many
+   sequences against the same few levels. Each level gets a table of the
+   states reachable from its start, so replaying is one table load per
+   move; the table is only read once built, and shared by every thread. */
+
+enum { REPLAY_LOST = -1, REPLAY_WON = -2 };
+
+class replay_table {
+	public:
+		board b;
+		std::vector<int> next; // reached state*4 + move -> reached state, REPLAY_LOST or REPLAY_WON
+		bool valid; // false when the level has too many states; replays then step through the rules
+
+		replay_table()
+		{
+			valid = false;
+		}
+};
+
+/* Enumerate the states reachable from the start; the start is state 0.
+   A BFS layer at a time: its four moves from every state are rolled and
+   their switches pressed, then the outcomes are taken in one batch. */
+inline replay_table build_replay_table(const board &b)
+{
+	replay_table t;
+	t.b = b;
+	if (state_count(b) > max_state_table)
+		return t;
+
+	std::vector<int> slot(state_count(b), -1); // dense state -> reached state
+	std::vector<int> order; // dense index of each reached state
+	slot[state_index(b, b.start)] = 0;
+	order.push_back(state_index(b, b.start));
+	pose_batch moved;
+	std::vector<int> outcomes;
+	for (int begin = 0, end; begin < (int)order.size(); begin = end)
+	{
+		end = order.size();
+		moved.resize(4*(end - begin));
+		for (int k = begin; k < end; k++)
+		{
+			pose p = state_pose(b, order[k]);
+			for (int dir = 0; dir < 4; dir++)
+			{
+				pose q = roll(p, dir);
+				press_switches(b, p, q);
+				moved.set(4*(k - begin) + dir, q);
+			}
+		}
+		outcomes.resize(moved.size());
+		tile_outcomes(b, moved, outcomes.data());
+		for (int e = 0; e < moved.size(); e++)
+		{
+			int next = outcomes[e] == GAME_WON ? REPLAY_WON : REPLAY_LOST;
+			if (outcomes[e] == GAME_IN_PROGRESS)
+			{
+				int s = state_index(b, moved.get(e));
+				if (slot[s] == -1)
+				{
+					slot[s] = order.size();
+					order.push_back(s);
+				}
+				next = slot[s];
+			}
+			t.next.push_back(next);
+		}
+	}
+	t.valid = true;
+	return t;
+}
+
+struct replay_result {
+	bool legal; // every move was made while the level was in progress
+	int outcome; // GAME_* after the moves played
+	int moves; // moves played
+};
+
+/* Play moves (MOVE_* each) from the start of the level. A move after the
+   level was won or lost makes the sequence illegal and ends the replay. */
+inline replay_result replay(const replay_table &t, const unsigned char *moves, size_t size)
+{
+	replay_result r = { true, GAME_IN_PROGRESS, 0 };
+	if (t.valid)
+	{
+		int s = 0;
+		for (; r.moves < (int)size && s >= 0; r.moves++)
+			s = t.next[s*4 + moves[r.moves]];
+		r.outcome = s == REPLAY_WON ? GAME_WON : s == REPLAY_LOST ? GAME_LOST : GAME_IN_PROGRESS;
+	}
+	else
+	{
+		pose p = t.b.start;
+		for (; r.moves < (int)size && r.outcome == GAME_IN_PROGRESS; r.moves++)
+			r.outcome = step(t.b, p, moves[r.moves]);
+	}
+	r.legal = r.moves == (int)size;
+	return r;
+}
+
+#endif
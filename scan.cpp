@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "levelfile.h"
+#include "jobs.h"
+#include "sessionlog.h"
+
+using namespace std;
+
+/* Session log scanner: decodes every block of the logs across all cores and
+   prints what the sessions add up to, as JSON.
+
+       scan [sessions.log]...
+
+   Blocks are found by walking the headers, then decoded side by side. A
+   log is read up to its first damaged header; blocks that fail their
+   checksum are skipped. Both count as damaged. */
+
+const int blocks_per_job = 256;
+
+job_system jobs;
+
+struct level_tally {
+	long long started, solved, fell;
+};
+
+/* What one run of blocks holds. Results before the run's first
+   SESSION_LEVEL or SESSION_BEGIN belong to the level the previous run ended
+   on; results with no level before them in their session are not counted
+   for any level. */
+struct tally {
+	long long events, sessions, moves, resets, undos, redos, nexts, restarts;
+	vector<level_tally> levels;
+	long long lead_solved, lead_fell;
+	bool opened; // a session or level began in the run
+	int last_level; // -1 = none since the session began
+
+	tally()
+	{
+		events = sessions = moves = resets = undos = redos = nexts = restarts = 0;
+		lead_solved = lead_fell = 0;
+		opened = false;
+		last_level = -1;
+	}
+
+	level_tally &level(int k)
+	{
+		if (k >= (int)levels.size())
+			levels.resize(k + 1, level_tally());
+		return levels[k];
+	}
+
+	void add(const session_event &e)
+	{
+		events++;
+		switch (e.kind)
+		{
+			case SESSION_MOVE: moves++; break;
+			case SESSION_RESET: e.value == SESSION_UNDO ? undos++ : e.value == SESSION_REDO ? redos++ : resets++; break;
+			case SESSION_NEXT: nexts++; break;
+			case SESSION_RESTART: restarts++; break;
+			case SESSION_BEGIN: sessions++; opened = true; last_level = -1; break;
+			case SESSION_LEVEL:
+				opened = true;
+				last_level = e.value;
+				level(e.value).started++;
+				break;
+			case SESSION_SOLVED:
+			case SESSION_FELL:
+				if (!opened)
+					(e.kind == SESSION_SOLVED ? lead_solved : lead_fell)++;
+				else if (last_level != -1)
+					(e.kind == SESSION_SOLVED ? level(last_level).solved : level(last_level).fell)++;
+				break;
+		}
+	}
+};
+
+int main (int argc, char** argv)
+{
+	vector<string> logs;
+	for (int a = 1; a < argc; a++)
+		logs.push_back(argv[a]);
+	if (logs.empty())
+		logs.push_back("sessions.log");
+
+	vector<vector<char>> data(logs.size());
+	struct block {
+		const unsigned char *p;
+		size_t size;
+	};
+	vector<block> blocks;
+	long long bytes = 0, damaged = 0;
+	for (int f = 0; f < (int)logs.size(); f++)
+	{
+		if (!read_text_file(logs[f], data[f]))
+		{
+			cerr << "scan: cannot read " << logs[f] << endl;
+			return 2;
+		}
+		bytes += data[f].size();
+		const unsigned char *p = (const unsigned char *)data[f].data(), *end = p + data[f].size();
+		while (p < end)
+		{
+			size_t payload = end - p >= session_header_size ? get_u32(p + 4) : 0;
+			if (end - p < session_header_size || memcmp(p, session_magic, 4) != 0 || payload > max_session_payload || payload > (size_t)(end - p) - session_header_size)
+			{
+				damaged++;
+				break;
+			}
+			block b = { p, session_header_size + payload };
+			blocks.push_back(b);
+			p += b.size;
+		}
+	}
+
+	auto start = chrono::steady_clock::now();
+	jobs.start();
+	int runs = (blocks.size() + blocks_per_job - 1) / blocks_per_job;
+	vector<tally> tallies(runs);
+	vector<long long> bad(runs, 0);
+	atomic<int> pending(runs);
+	for (int r = 0; r < runs; r++)
+		jobs.run([&, r]() {
+			vector<session_event> events(max_session_events);
+			int last = min((int)blocks.size(), (r + 1)*blocks_per_job);
+			for (int k = r*blocks_per_job; k < last; k++)
+			{
+				size_t count = 0;
+				if (decode_session_block(blocks[k].p, blocks[k].size, events.data(), count) == 0)
+				{
+					bad[r]++; // fails its checksum: skipped
+					continue;
+				}
+				for (size_t e = 0; e < count; e++)
+					tallies[r].add(events[e]);
+			}
+			pending--;
+		});
+	jobs.help_until([&]() { return pending == 0; });
+	jobs.stop();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// the runs in order, handing each the level the one before ended on
+	tally total;
+	int level = -1;
+	for (int r = 0; r < runs; r++)
+	{
+		tally &t = tallies[r];
+		total.events += t.events;
+		total.sessions += t.sessions;
+		total.moves += t.moves;
+		total.resets += t.resets;
+		total.undos += t.undos;
+		total.redos += t.redos;
+		total.nexts += t.nexts;
+		total.restarts += t.restarts;
+		damaged += bad[r];
+		if (level != -1)
+		{
+			total.level(level).solved += t.lead_solved;
+			total.level(level).fell += t.lead_fell;
+		}
+		for (int k = 0; k < (int)t.levels.size(); k++)
+		{
+			total.level(k).started += t.levels[k].started;
+			total.level(k).solved += t.levels[k].solved;
+			total.level(k).fell += t.levels[k].fell;
+		}
+		if (t.opened)
+			level = t.last_level;
+	}
+
+	cout << "{\n  \"bytes\": " << bytes << ", \"blocks\": " << blocks.size() << ", \"damaged_blocks\": " << damaged
+		<< ", \"seconds\": " << seconds << ", \"bytes_per_sec\": " << (long long)(bytes / max(seconds, 1e-9)) << ",\n"
+		<< "  \"sessions\": " << total.sessions << ", \"events\": " << total.events << ", \"moves\": " << total.moves
+		<< ", \"resets\": " << total.resets << ", \"undos\": " << total.undos << ", \"redos\": " << total.redos
+		<< ", \"next\": " << total.nexts << ", \"restarts\": " << total.restarts << ",\n  \"levels\": [\n";
+	for (int k = 0; k < (int)total.levels.size(); k++)
+		cout << "    { \"level\": " << k + 1 << ", \"started\": " << total.levels[k].started << ", \"solved\": " << total.levels[k].solved
+			<< ", \"fell\": " << total.levels[k].fell << " }" << (k + 1 < (int)total.levels.size() ? "," : "") << "\n";
+	cout << "  ]\n}" << endl;
+	return 0;
+}
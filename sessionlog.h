@@ -0,0 +1,383 @@
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define HAVE_SSE2_SESSION_DECODE 1
+#endif
+
+/**************************
+ * Session logs           *
+ **************************/
+
+/* What was played, compact enough to keep every session: the keys that
+   drive the game and the results they led to, each stamped with the tick
+   (1/60 s) since the session began.
+
+   The log is a sequence of blocks, each of which decodes on its own:
+       "BLXS"                    magic
+       payload size              32 bits little endian, at most max_session_payload
+       payload checksum          32 bits little endian, session_checksum
+       tick before the block     32 bits little endian
+       payload                   events, one after the other
+   An event is one byte for a move less than 32 ticks after the previous
+   event, the common case:
+       0 ddddd mm                d = ticks since the previous event, m = move 0-3
+   and otherwise a byte followed by the ticks since the previous event as a
+   varint (7 bits per byte, low bits first, high bit set on all but the last):
+       1 kkk 00 mm               k = SESSION_*, m = move for SESSION_MOVE,
+                                 SESSION_UNDO or SESSION_REDO for SESSION_RESET
+   SESSION_LEVEL is followed by a second varint, the level (0-based), and
+   SESSION_BEGIN by the start of the session in seconds since the epoch;
+   SESSION_BEGIN sets the tick back to 0 rather than advancing it.
+
+   Decoding takes the bytes 16 at a time (8 without SSE2): every byte is
+   decoded as a move without branching, and only the moves before the first
+   escape byte are kept. */
+
+enum {
+	SESSION_MOVE = 0, // arrow key, value = direction as in cuboid::move
+	SESSION_RESET = 1, // R, or Z or Y as value says
+	SESSION_NEXT = 2, // N
+	SESSION_RESTART = 3, // ENTER
+	SESSION_SOLVED = 4,
+	SESSION_FELL = 5,
+	SESSION_LEVEL = 6, // a level began, value = level
+	SESSION_BEGIN = 7 // tick = seconds since the epoch, the ticks after it count from 0
+};
+
+enum { SESSION_UNDO = 1, SESSION_REDO = 2 }; // value of a SESSION_RESET that was not R
+
+struct session_event {
+	unsigned tick;
+	unsigned short value; // move, level, or SESSION_UNDO/REDO
+	unsigned char kind; // SESSION_*
+	unsigned char reserved;
+};
+static_assert(sizeof(session_event) == 8, "session_event is written with one store");
+
+const char session_magic[4] = { 'B', 'L', 'X', 'S' };
+const int session_header_size = 16;
+const int max_session_payload = 1 << 16;
+const int max_session_events = max_session_payload + 16; // room decode_session_block needs for any block
+const int session_block_payload = 4096; // what the encoder aims for
+
+inline unsigned long long get_u64(const unsigned char *p)
+{
+	return (unsigned long long)p[0] | (unsigned long long)p[1] << 8 | (unsigned long long)p[2] << 16 | (unsigned long long)p[3] << 24
+		| (unsigned long long)p[4] << 32 | (unsigned long long)p[5] << 40 | (unsigned long long)p[6] << 48 | (unsigned long long)p[7] << 56;
+}
+
+/* Fletcher-style sums over the data as 64-bit little endian words, the last
+   one padded with zeros, folded into 32 bits */
+inline unsigned session_checksum(const unsigned char *data, size_t size)
+{
+	unsigned long long a = 1, b = 0;
+	size_t k = 0;
+	for (; k + 8 <= size; k += 8)
+	{
+		a += get_u64(data + k);
+		b += a;
+	}
+	unsigned char last[8] = { 0 };
+	memcpy(last, data + k, size - k);
+	a += get_u64(last);
+	b += a;
+	unsigned long long h = a ^ (b << 29 | b >> 35);
+	return (unsigned)(h ^ h >> 32);
+}
+
+inline void put_u32(unsigned char *p, unsigned v)
+{
+	for (int k = 0; k < 4; k++)
+		p[k] = v >> (8*k);
+}
+
+inline unsigned get_u32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+/* Builds blocks one event at a time */
+class session_encoder {
+	public:
+		session_encoder()
+		{
+			tick = base = 0;
+		}
+
+		// ticks before the last event's are taken as the same tick
+		void add(int kind, unsigned at, unsigned value = 0)
+		{
+			unsigned delta = at > tick ? at - tick : 0;
+			tick = kind == SESSION_BEGIN ? 0 : tick + delta;
+			if (kind == SESSION_MOVE && delta < 32)
+			{
+				payload.push_back(delta << 2 | (value & 3));
+				return;
+			}
+			payload.push_back(0x80 | kind << 4 | (kind == SESSION_MOVE || kind == SESSION_RESET ? value & 3 : 0));
+			put_varint(delta);
+			if (kind == SESSION_LEVEL || kind == SESSION_BEGIN)
+				put_varint(value);
+		}
+
+		// time to finish the block
+		bool full() const
+		{
+			return payload.size() >= session_block_payload;
+		}
+
+		bool empty() const
+		{
+			return payload.empty();
+		}
+
+		// append the block of the events added so far to out and start the next one
+		void finish(std::vector<unsigned char> &out)
+		{
+			if (payload.empty())
+				return;
+			size_t at = out.size();
+			out.resize(at + session_header_size);
+			memcpy(&out[at], session_magic, 4);
+			put_u32(&out[at + 4], payload.size());
+			put_u32(&out[at + 8], session_checksum(payload.data(), payload.size()));
+			put_u32(&out[at + 12], base);
+			out.insert(out.end(), payload.begin(), payload.end());
+			payload.clear();
+			base = tick;
+		}
+
+	private:
+		std::vector<unsigned char> payload;
+		unsigned tick; // of the last event added
+		unsigned base; // tick before the block being built
+
+		void put_varint(unsigned v)
+		{
+			for (; v >= 0x80; v >>= 7)
+				payload.push_back(v | 0x80);
+			payload.push_back(v);
+		}
+};
+
+// one-byte move b after tick
+inline void put_move(session_event &e, unsigned &tick, unsigned b)
+{
+	tick += (b >> 2) & 31;
+	e.tick = tick;
+	e.value = b & 3;
+	e.kind = SESSION_MOVE;
+	e.reserved = 0;
+}
+
+#ifdef HAVE_SSE2_SESSION_DECODE
+// running sums of eight 16-bit lanes
+inline __m128i prefix_sums16(__m128i v)
+{
+	v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+	v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+	return _mm_add_epi16(v, _mm_slli_si128(v, 8));
+}
+
+// events of four moves, from their ticks and moves in the low 16 bits of each 32-bit lane
+inline void put_moves4(__m128i *out, __m128i ticks, __m128i moves)
+{
+	_mm_storeu_si128(out, _mm_unpacklo_epi32(ticks, moves));
+	_mm_storeu_si128(out + 1, _mm_unpackhi_epi32(ticks, moves));
+}
+
+// the 16 bytes at p as moves; returns how many come before the first escape byte
+inline int decode_moves_sse2(const unsigned char *p, session_event *e, unsigned &tick)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)p), zero = _mm_setzero_si128();
+	__m128i deltas = _mm_and_si128(_mm_srli_epi16(x, 2), _mm_set1_epi8(31));
+	__m128i moves = _mm_and_si128(x, _mm_set1_epi8(3));
+
+	// 16 deltas sum to at most 496, so 16-bit lanes hold the running sums
+	__m128i lo = prefix_sums16(_mm_unpacklo_epi8(deltas, zero));
+	__m128i hi = prefix_sums16(_mm_unpackhi_epi8(deltas, zero));
+	hi = _mm_add_epi16(hi, _mm_set1_epi16(_mm_extract_epi16(lo, 7)));
+
+	__m128i base = _mm_set1_epi32(tick), low_moves = _mm_unpacklo_epi8(moves, zero), high_moves = _mm_unpackhi_epi8(moves, zero);
+	__m128i *out = (__m128i *)e; // the layout of session_event on a little endian machine
+	put_moves4(out, _mm_add_epi32(base, _mm_unpacklo_epi16(lo, zero)), _mm_unpacklo_epi16(low_moves, zero));
+	put_moves4(out + 2, _mm_add_epi32(base, _mm_unpackhi_epi16(lo, zero)), _mm_unpackhi_epi16(low_moves, zero));
+	put_moves4(out + 4, _mm_add_epi32(base, _mm_unpacklo_epi16(hi, zero)), _mm_unpacklo_epi16(high_moves, zero));
+	put_moves4(out + 6, _mm_add_epi32(base, _mm_unpackhi_epi16(hi, zero)), _mm_unpackhi_epi16(high_moves, zero));
+
+	int escapes = _mm_movemask_epi8(x);
+	int n = escapes ? __builtin_ctz(escapes) : 16;
+	if (n > 0)
+		tick = e[n - 1].tick;
+	return n;
+}
+#endif
+
+/* Decode the one-byte moves at p into e, up to the first escape byte and at
+   most 16 of them; returns how many. Up to 16 events past them are
+   overwritten. */
+inline int decode_moves(const unsigned char *p, const unsigned char *end, session_event *e, unsigned &tick)
+{
+#ifdef HAVE_SSE2_SESSION_DECODE
+	if (end - p >= 16)
+		return decode_moves_sse2(p, e, tick);
+#endif
+	if (end - p >= 8)
+	{
+		unsigned long long w = get_u64(p);
+		unsigned t = tick;
+		for (int k = 0; k < 8; k++)
+			put_move(e[k], t, w >> (8*k));
+		unsigned long long escapes = w & 0x8080808080808080ull;
+		int n = escapes ? __builtin_ctzll(escapes) >> 3 : 8;
+		if (n > 0)
+			tick = e[n - 1].tick;
+		return n;
+	}
+	if (*p >= 0x80)
+		return 0;
+	put_move(*e, tick, *p);
+	return 1;
+}
+
+/* The varint at p, when at least 8 bytes follow it, without branching.
+   Returns its size, or 0 if it runs past 5 bytes. */
+inline int get_varint8(const unsigned char *p, unsigned &v)
+{
+	unsigned long long w = get_u64(p);
+	unsigned long long last = ~w & 0x8080808080808080ull; // the final byte has the high bit clear
+	int size = last ? (__builtin_ctzll(last) >> 3) + 1 : 9;
+	v = (w & 0x7f) | (w >> 1 & 0x7f << 7) | (w >> 2 & 0x7f << 14) | (w >> 3 & 0x7f << 21) | (w >> 4 & 0xfull << 28);
+	if (size < 5)
+		v &= (1u << 7*size) - 1;
+	return size <= 5 ? size : 0;
+}
+
+/* The varint at p, ending before end; returns its size, 0 if it is cut short or runs past 5 bytes */
+inline int get_varint(const unsigned char *p, const unsigned char *end, unsigned &v)
+{
+	if (end - p >= 8)
+		return get_varint8(p, v);
+	v = 0;
+	for (int size = 0; size < 5 && p + size < end; size++)
+	{
+		v |= (p[size] & 0x7fu) << 7*size;
+		if (p[size] < 0x80)
+			return size + 1;
+	}
+	return 0;
+}
+
+/* Decode the block at the start of data into out, which must have room for
+   16 more events than the payload has bytes (max_session_events covers any
+   block). Returns the size of the block, or 0 if it is cut short, corrupt
+   or fails its checksum; count is then left unchanged. */
+inline size_t decode_session_block(const unsigned char *data, size_t size, session_event *out, size_t &count)
+{
+	if (size < session_header_size || memcmp(data, session_magic, 4) != 0)
+		return 0;
+	size_t payload = get_u32(data + 4);
+	if (payload > max_session_payload || payload > size - session_header_size)
+		return 0;
+	const unsigned char *p = data + session_header_size, *end = p + payload;
+	if (session_checksum(p, payload) != get_u32(data + 8))
+		return 0;
+
+	unsigned tick = get_u32(data + 12);
+	session_event *e = out;
+	while (p < end)
+	{
+		int n = decode_moves(p, end, e, tick);
+		p += n;
+		e += n;
+		if (p == end || *p < 0x80)
+			continue;
+
+		unsigned b = *p++, kind = (b >> 4) & 7, delta, value = b & 3;
+		int size = get_varint(p, end, delta);
+		if (size == 0)
+			return 0;
+		p += size;
+		if (kind == SESSION_LEVEL || kind == SESSION_BEGIN)
+		{
+			size = get_varint(p, end, value);
+			if (size == 0)
+				return 0;
+			p += size;
+		}
+		else if (kind != SESSION_MOVE && kind != SESSION_RESET)
+			value = 0;
+		tick = kind == SESSION_BEGIN ? 0 : tick + delta;
+		e->tick = kind == SESSION_BEGIN ? value : tick;
+		e->value = kind == SESSION_BEGIN ? 0 : value;
+		e->kind = kind;
+		e->reserved = 0;
+		e++;
+	}
+	count = e - out;
+	return session_header_size + payload;
+}
+
+/* Appends a session to a log file, a block at a time */
+class session_writer {
+	public:
+		session_writer()
+		{
+			file = NULL;
+		}
+
+		~session_writer()
+		{
+			close();
+		}
+
+		bool open(const std::string &path, unsigned started)
+		{
+			close();
+			file = fopen(path.c_str(), "ab");
+			if (file)
+				add(SESSION_BEGIN, 0, started);
+			return file != NULL;
+		}
+
+		void add(int kind, unsigned tick, unsigned value = 0)
+		{
+			if (!file)
+				return;
+			encoder.add(kind, tick, value);
+			if (encoder.full())
+				flush();
+		}
+
+		void flush()
+		{
+			if (!file || encoder.empty())
+				return;
+			block.clear();
+			encoder.finish(block);
+			fwrite(block.data(), 1, block.size(), file);
+			fflush(file);
+		}
+
+		void close()
+		{
+			flush();
+			if (file)
+				fclose(file);
+			file = NULL;
+		}
+
+	private:
+		FILE *file;
+		session_encoder encoder;
+		std::vector<unsigned char> block; // reused for every block written
+};
+
+#endif
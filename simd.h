@@ -0,0 +1,141 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <vector>
+
+#include "logic.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#endif
+
+/**************************
+ * Batch rule kernels     *
+ **************************/
+
+/* tile_outcome() for many independent game states at once. The states are
+   kept as a structure of arrays so eight of them fill one AVX2 register;
+   machines without AVX2 get the scalar loop. */
+
+class pose_batch {
+	public:
+		std::vector<int> i, j, state;
+		std::vector<unsigned> bridges;
+
+		int size() const
+		{
+			return i.size();
+		}
+
+		void resize(int n)
+		{
+			i.resize(n);
+			j.resize(n);
+			state.resize(n);
+			bridges.resize(n);
+		}
+
+		void set(int k, const pose &p)
+		{
+			i[k] = p.i;
+			j[k] = p.j;
+			state[k] = p.state;
+			bridges[k] = p.bridges;
+		}
+
+		pose get(int k) const
+		{
+			pose p;
+			p.i = i[k];
+			p.j = j[k];
+			p.state = state[k];
+			p.bridges = bridges[k];
+			return p;
+		}
+};
+
+inline void tile_outcomes_scalar(const board &b, const pose_batch &p, int begin, int end, int *outcome)
+{
+	for (int k = begin; k < end; k++)
+		outcome[k] = tile_outcome(b, p.get(k));
+}
+
+#ifdef HAVE_AVX2_KERNEL
+/* Eight states per iteration: both cells are gathered from the board with
+   off-map lanes masked to TILE_EMPTY, then the support rules are evaluated
+   as lane masks */
+__attribute__((target("avx2"))) inline void tile_outcomes_avx2(const board &b, const pose_batch &p, int *outcome)
+{
+	int n = p.size(), k = 0;
+	const int *type = b.type.data(), *bridge_bit = b.bridge_bit.data();
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2);
+	const __m256i rows = _mm256_set1_epi32(b.rows), cols = _mm256_set1_epi32(b.cols);
+	const __m256i no_bit = _mm256_set1_epi32(-1);
+	const __m256i bridge = _mm256_set1_epi32(TILE_BRIDGE), fragile = _mm256_set1_epi32(TILE_FRAGILE), goal = _mm256_set1_epi32(TILE_GOAL);
+	const __m256i lost = _mm256_set1_epi32(GAME_LOST), won = _mm256_set1_epi32(GAME_WON);
+
+	for (; k + 8 <= n; k += 8)
+	{
+		__m256i i1 = _mm256_loadu_si256((const __m256i *)&p.i[k]);
+		__m256i j1 = _mm256_loadu_si256((const __m256i *)&p.j[k]);
+		__m256i state = _mm256_loadu_si256((const __m256i *)&p.state[k]);
+		__m256i bridges = _mm256_loadu_si256((const __m256i *)&p.bridges[k]);
+
+		// cube_cells: the compares are all ones (-1) where they hold
+		__m256i i2 = _mm256_sub_epi32(i1, _mm256_cmpeq_epi32(state, zero));
+		__m256i j2 = _mm256_sub_epi32(j1, _mm256_cmpeq_epi32(state, two));
+
+		__m256i supported[2], tile1;
+		for (int c = 0; c < 2; c++)
+		{
+			__m256i i = c ? i2 : i1, j = c ? j2 : j1;
+			__m256i on_map = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(zero, i), _mm256_cmpgt_epi32(zero, j)),
+					_mm256_and_si256(_mm256_cmpgt_epi32(rows, i), _mm256_cmpgt_epi32(cols, j)));
+			__m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(i, cols), j);
+			__m256i t = _mm256_mask_i32gather_epi32(zero, type, cell, on_map, 4);
+			__m256i bit = _mm256_mask_i32gather_epi32(no_bit, bridge_bit, cell, on_map, 4);
+			// a shift by -1 yields 0, so bridges no switch controls are never shown
+			__m256i shown = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_srlv_epi32(bridges, bit), one), one);
+			__m256i filled = _mm256_xor_si256(_mm256_cmpeq_epi32(t, zero), no_bit);
+			supported[c] = _mm256_blendv_epi8(filled, shown, _mm256_cmpeq_epi32(t, bridge));
+			if (c == 0)
+				tile1 = t;
+		}
+
+		__m256i standing = _mm256_cmpeq_epi32(state, one);
+		__m256i fails = _mm256_or_si256(_mm256_xor_si256(_mm256_and_si256(supported[0], supported[1]), no_bit),
+				_mm256_and_si256(standing, _mm256_cmpeq_epi32(tile1, fragile))); // breaking condition
+		__m256i wins = _mm256_and_si256(standing, _mm256_cmpeq_epi32(tile1, goal));
+		__m256i result = _mm256_blendv_epi8(_mm256_and_si256(wins, won), lost, fails);
+		_mm256_storeu_si256((__m256i *)&outcome[k], result);
+	}
+	tile_outcomes_scalar(b, p, k, n, outcome);
+}
+#endif
+
+inline bool have_avx2()
+{
+#ifdef HAVE_AVX2_KERNEL
+	static const bool supported = __builtin_cpu_supports("avx2");
+	return supported;
+#else
+	return false;
+#endif
+}
+
+/* Outcome of every state in the batch, with the widest kernel the CPU runs */
+inline void tile_outcomes(const board &b, const pose_batch &p, int *outcome)
+{
+#ifdef HAVE_AVX2_KERNEL
+	if (have_avx2())
+	{
+		tile_outcomes_avx2(b, p, outcome);
+		return;
+	}
+#endif
+	tile_outcomes_scalar(b, p, 0, p.size(), outcome);
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef SOLVECACHE_H
+#define SOLVECACHE_H
+
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "logic.h"
+#include "solver.h"
+#include "zobrist.h"
+
+/**************************
+ * Solver cache           *
+ **************************/
+
+/* Shortest solution lengths kept by the Zobrist hash of the board they
+   were solved for (tiles, switch table and start), so a board seen before
+   is never solved again. Entries are evicted least recently used first
+   once they take more than the memory budget, and the cache can be saved
+   and loaded so it carries over between runs. Two boards sharing a 64-bit
+   hash would share a result; at the number of boards a pack holds that
+   chance is negligible.
+
+   levelc is the one user: it checks every level of a pack is solvable,
+   one level at a time, so an entry holds the move count alone and the
+   cache is not locked. */
+
+class solve_cache {
+	public:
+		long long hits, misses, evictions;
+
+		solve_cache(size_t budget_bytes = 64 << 20)
+		{
+			budget = budget_bytes;
+			used = 0;
+			hits = misses = evictions = 0;
+		}
+
+		// moves = length of the shortest solution, -1 = unsolvable
+		bool find(unsigned long long key, int &moves)
+		{
+			auto found = index.find(key);
+			if (found == index.end())
+			{
+				misses++;
+				return false;
+			}
+			entries.splice(entries.begin(), entries, found->second); // now the most recently used
+			moves = found->second->moves;
+			hits++;
+			return true;
+		}
+
+		void insert(unsigned long long key, int moves)
+		{
+			auto found = index.find(key);
+			if (found != index.end())
+			{
+				entries.erase(found->second);
+				index.erase(found);
+				used -= entry_cost;
+			}
+			entry e;
+			e.key = key;
+			e.moves = moves;
+			entries.push_front(e);
+			index[key] = entries.begin();
+			used += entry_cost;
+			while (used > budget && entries.size() > 1)
+			{
+				used -= entry_cost;
+				index.erase(entries.back().key);
+				entries.pop_back();
+				evictions++;
+			}
+		}
+
+		size_t size() const
+		{
+			return entries.size();
+		}
+
+		/* File: the magic "BLXC", a format version byte, three reserved bytes,
+		   then per entry, most recently used first and little endian: the key
+		   (64 bits) and the moves (32 bits, -1 = unsolvable). */
+		bool save(const std::string &path)
+		{
+			std::string temporary = path + ".tmp"; // renamed over path once complete
+			FILE *f = fopen(temporary.c_str(), "wb");
+			if (!f)
+				return false;
+			unsigned char header[8] = { 'B', 'L', 'X', 'C', cache_version, 0, 0, 0 };
+			bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+			std::vector<unsigned char> record;
+			for (auto e = entries.begin(); ok && e != entries.end(); ++e)
+			{
+				record.clear();
+				put(record, e->key, 8);
+				put(record, (unsigned)e->moves, 4);
+				ok = fwrite(record.data(), 1, record.size(), f) == record.size();
+			}
+			ok = fclose(f) == 0 && ok;
+			if (ok)
+				ok = rename(temporary.c_str(), path.c_str()) == 0;
+			else
+				remove(temporary.c_str());
+			return ok;
+		}
+
+		// false when the file is missing or not a cache of this version; entries read before a damaged one are kept
+		bool load(const std::string &path)
+		{
+			FILE *f = fopen(path.c_str(), "rb");
+			if (!f)
+				return false;
+			unsigned char header[8];
+			bool ok = fread(header, 1, sizeof(header), f) == sizeof(header) && memcmp(header, "BLXC", 4) == 0 && header[4] == cache_version;
+			std::vector<std::pair<unsigned long long, int>> read;
+			unsigned char record[12];
+			while (ok && fread(record, 1, sizeof(record), f) == sizeof(record))
+				read.push_back(std::make_pair(get(record, 8), (int)get(record + 8, 4)));
+			fclose(f);
+			for (int k = (int)read.size() - 1; k >= 0; k--) // oldest first, so the order of use carries over
+				insert(read[k].first, read[k].second);
+			return ok;
+		}
+
+	private:
+		struct entry {
+			unsigned long long key;
+			int moves;
+		};
+
+		static const unsigned char cache_version = 2; // 1 also kept the path
+
+		// bytes an entry takes, roughly: the list node and its index slot
+		static const size_t entry_cost = sizeof(entry) + 2*sizeof(void*) + sizeof(unsigned long long) + 2*sizeof(void*);
+
+		std::list<entry> entries; // most recently used first
+		std::unordered_map<unsigned long long, std::list<entry>::iterator> index;
+		size_t budget, used; // bytes
+
+		static void put(std::vector<unsigned char> &out, unsigned long long v, int bytes)
+		{
+			for (int k = 0; k < bytes; k++)
+				out.push_back(v >> (8*k));
+		}
+
+		static unsigned long long get(const unsigned char *p, int bytes)
+		{
+			unsigned long long v = 0;
+			for (int k = 0; k < bytes; k++)
+				v |= (unsigned long long)p[k] << (8*k);
+			return v;
+		}
+};
+
+/* Moves of the shortest solution of a board, -1 = unsolvable, through the
+   cache: solved bidirectionally when it has bridges, where that runs about
+   twice as fast as solve_bfs, else by solve_bfs */
+inline int cached_solve(solve_cache &cache, const board &b)
+{
+	unsigned long long key = zobrist_board(b);
+	int moves;
+	if (cache.find(key, moves))
+		return moves;
+	moves = (b.num_bridges > 0 ? solve_bidirectional(b) : solve_bfs(b)).moves;
+	cache.insert(key, moves);
+	return moves;
+}
+
+#endif
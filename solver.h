@@ -0,0 +1,343 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <algorithm>
+#include <vector>
+
+#include "logic.h"
+
+/**************************
+ * Solvers                *
+ **************************/
+
+// dense state tables bigger than this are not built
+const long long max_state_table = 1 << 24;
+
+/* Dense index of a pose: ((bridges * cells) + cell) * 3 + state */
+inline long long state_count(const board &b)
+{
+	return (1LL << b.num_bridges) * b.rows * b.cols * 3;
+}
+
+inline int state_index(const board &b, const pose &p)
+{
+	return ((int)p.bridges * b.rows * b.cols + p.i * b.cols + p.j) * 3 + p.state;
+}
+
+inline pose state_pose(const board &b, int index)
+{
+	pose p;
+	int cells = b.rows * b.cols;
+	p.state = index % 3;
+	index /= 3;
+	p.i = (index % cells) / b.cols;
+	p.j = (index % cells) % b.cols;
+	p.bridges = index / cells;
+	return p;
+}
+
+struct solve_result {
+	int moves; // length of the shortest solution, -1 = unsolvable
+	long long expanded; // states taken off the queue
+	std::vector<int> path; // the moves of the solution
+};
+
+/* Plain forward BFS from the start to the first winning state */
+inline solve_result solve_bfs(const board &b)
+{
+	solve_result result;
+	result.moves = -1;
+	result.expanded = 0;
+	if (state_count(b) > max_state_table)
+		return result;
+
+	std::vector<int> parent(state_count(b), -1); // predecessor*4 + move, -2 for the start
+	std::vector<int> queue;
+	int s = state_index(b, b.start);
+	parent[s] = -2;
+	queue.push_back(s);
+	for (int k = 0; k < (int)queue.size(); k++)
+	{
+		pose to[4];
+		int outcomes[4];
+		step_all(b, state_pose(b, queue[k]), to, outcomes);
+		result.expanded++;
+		for (int dir = 0; dir < 4; dir++)
+		{
+			int outcome = outcomes[dir];
+			if (outcome == GAME_LOST)
+				continue;
+			int t = state_index(b, to[dir]);
+			if (parent[t] != -1)
+				continue;
+			parent[t] = queue[k]*4 + dir;
+			if (outcome == GAME_WON)
+			{
+				for (int u = t; parent[u] != -2; u = parent[u] / 4)
+					result.path.insert(result.path.begin(), parent[u] % 4);
+				result.moves = result.path.size();
+				return result;
+			}
+			queue.push_back(t);
+		}
+	}
+	return result;
+}
+
+/* The pose a move in direction dir reached p from, or false when no state
+   in progress leads to p that way. Rolls are undone by rolling the other
+   way; the switches the move pressed flipped their bridges, so flipping
+   them again gives the bridges before it. */
+inline bool unstep(const board &b, const pose &p, int dir, pose &from)
+{
+	from = roll(p, dir ^ 1); // MOVE_LEFT <-> MOVE_RIGHT, MOVE_UP <-> MOVE_DOWN
+	pose q = roll(from, dir);
+	apply_rules(b, from, q); // flips on p's bridges the ones the move flipped
+	from.bridges = q.bridges;
+	return tile_outcome(b, from) == GAME_IN_PROGRESS;
+}
+
+/* Bidirectional BFS: forwards from the start and backwards from every
+   winning state play can reach (standing on the goal, with any bridges the
+   switches can show), a whole layer of the smaller frontier at a time,
+   until the two meet. Same answer as solve_bfs; a path of n moves costs
+   about two searches n/2 deep instead of one n deep. */
+inline solve_result solve_bidirectional(const board &b)
+{
+	solve_result result;
+	result.moves = -1;
+	result.expanded = 0;
+	if (state_count(b) > max_state_table)
+		return result;
+
+	/* One table for both sides, so it costs no more memory than solve_bfs:
+	   (neighbour*4 + move)*2 + side, where the neighbour is the predecessor
+	   forwards (side 0) and the successor backwards (side 1); the start and
+	   the winning states are their own neighbour */
+	int n = (int)state_count(b);
+	std::vector<int> link(n, -1);
+	std::vector<int> forward, backward, layer;
+	int s = state_index(b, b.start);
+	link[s] = s*8;
+	forward.push_back(s);
+
+	/* Bridges only ever change by a switch's toggles, so play from the
+	   start can reach no masks but the start's XOR some combination of
+	   them: a coset, doubled by each toggle not yet in it */
+	std::vector<unsigned> masks(1, b.start.bridges);
+	for (int c = 0; c < b.rows*b.cols; c++)
+		if (b.toggles[c] && std::find(masks.begin(), masks.end(), masks[0] ^ b.toggles[c]) == masks.end())
+			for (int m = 0, size = (int)masks.size(); m < size; m++)
+				masks.push_back(masks[m] ^ b.toggles[c]);
+	for (int c = 0; c < b.rows*b.cols; c++)
+		if (b.type[c] == TILE_GOAL)
+			for (int m = 0; m < (int)masks.size(); m++)
+			{
+				pose g = { c / b.cols, c % b.cols, 1, masks[m] };
+				int t = state_index(b, g);
+				if (link[t] != -1)
+					continue; // the start itself, as in solve_bfs never a win
+				link[t] = t*8 + 1;
+				backward.push_back(t);
+			}
+
+	// moves between a state and the start or the goal, along its side's links
+	auto depth = [&link](int t) {
+		int d = 0;
+		for (; link[t] / 8 != t; t = link[t] / 8)
+			d++;
+		return d;
+	};
+	int best = -1, meet_from = -1, meet_to = -1, meet_move = -1;
+	while (best == -1 && !forward.empty() && !backward.empty())
+	{
+		layer.clear();
+		if (forward.size() <= backward.size())
+		{
+			for (int k = 0; k < (int)forward.size(); k++)
+			{
+				pose to[4];
+				int outcomes[4];
+				step_all(b, state_pose(b, forward[k]), to, outcomes);
+				result.expanded++;
+				for (int dir = 0; dir < 4; dir++)
+				{
+					if (outcomes[dir] == GAME_LOST)
+						continue;
+					int t = state_index(b, to[dir]);
+					if (link[t] == -1)
+					{
+						link[t] = (forward[k]*4 + dir)*2;
+						layer.push_back(t);
+					}
+					else if (link[t] & 1)
+					{
+						int length = depth(forward[k]) + 1 + depth(t);
+						if (best == -1 || length < best)
+						{
+							best = length;
+							meet_from = forward[k];
+							meet_to = t;
+							meet_move = dir;
+						}
+					}
+				}
+			}
+			forward.swap(layer);
+		}
+		else
+		{
+			for (int k = 0; k < (int)backward.size(); k++)
+			{
+				pose p = state_pose(b, backward[k]);
+				result.expanded++;
+				for (int dir = 0; dir < 4; dir++)
+				{
+					pose from;
+					if (!unstep(b, p, dir, from))
+						continue;
+					int t = state_index(b, from);
+					if (link[t] == -1)
+					{
+						link[t] = (backward[k]*4 + dir)*2 + 1;
+						layer.push_back(t);
+					}
+					else if (!(link[t] & 1))
+					{
+						int length = depth(t) + 1 + depth(backward[k]);
+						if (best == -1 || length < best)
+						{
+							best = length;
+							meet_from = t;
+							meet_to = backward[k];
+							meet_move = dir;
+						}
+					}
+				}
+			}
+			backward.swap(layer);
+		}
+	}
+	if (best == -1)
+		return result;
+
+	for (int u = meet_from; link[u] / 8 != u; u = link[u] / 8)
+		result.path.insert(result.path.begin(), link[u] / 2 % 4);
+	result.path.push_back(meet_move);
+	for (int u = meet_to; link[u] / 8 != u; u = link[u] / 8)
+		result.path.push_back(link[u] / 2 % 4);
+	result.moves = result.path.size();
+	return result;
+}
+
+/* Distance-to-goal table over every state reachable from the start.
+   Built once per level; lookups are a single table load. */
+class distance_field {
+	public:
+		std::vector<int> dist; // moves to the goal, -1 = unreachable or no way out
+		std::vector<signed char> next; // optimal move from each state, -1 = none
+		bool valid;
+
+		distance_field()
+		{
+			valid = false;
+		}
+
+		int distance(const board &b, const pose &p) const
+		{
+			if (!valid || b.cell(p.i, p.j) == -1 || p.bridges >> b.num_bridges)
+				return -1;
+			return dist[state_index(b, p)];
+		}
+
+		int hint(const board &b, const pose &p) const
+		{
+			if (!valid || b.cell(p.i, p.j) == -1 || p.bridges >> b.num_bridges)
+				return -1;
+			return next[state_index(b, p)];
+		}
+};
+
+/* Enumerate the transition graph forwards from the start, then run a reverse
+   BFS from the winning states over the inverted edges. */
+inline distance_field build_distance_field(const board &b)
+{
+	distance_field field;
+	if (state_count(b) > max_state_table)
+		return field;
+
+	int n = (int)state_count(b);
+	std::vector<int> succ; // 4 successors per reached state, -1 = lost
+	std::vector<int> order; // reached states in BFS order
+	std::vector<int> slot(n, -1); // state -> position in order
+	std::vector<bool> won(n, false);
+
+	int s = state_index(b, b.start);
+	slot[s] = 0;
+	order.push_back(s);
+	for (int k = 0; k < (int)order.size(); k++)
+	{
+		pose to[4];
+		int outcomes[4];
+		step_all(b, state_pose(b, order[k]), to, outcomes);
+		for (int dir = 0; dir < 4; dir++)
+		{
+			int outcome = won[order[k]] ? GAME_LOST : outcomes[dir];
+			if (outcome == GAME_LOST)
+			{
+				succ.push_back(-1);
+				continue;
+			}
+			int t = state_index(b, to[dir]);
+			if (slot[t] == -1)
+			{
+				slot[t] = order.size();
+				order.push_back(t);
+			}
+			if (outcome == GAME_WON)
+				won[t] = true;
+			succ.push_back(t);
+		}
+	}
+
+	// invert the edges into a compressed predecessor list
+	int m = order.size();
+	std::vector<int> first(m + 1, 0), pred(succ.size());
+	for (int e = 0; e < (int)succ.size(); e++)
+		if (succ[e] != -1)
+			first[slot[succ[e]] + 1]++;
+	for (int k = 0; k < m; k++)
+		first[k + 1] += first[k];
+	std::vector<int> fill(first.begin(), first.end() - 1);
+	for (int e = 0; e < (int)succ.size(); e++)
+		if (succ[e] != -1)
+			pred[fill[slot[succ[e]]]++] = e;
+
+	field.dist.assign(n, -1);
+	field.next.assign(n, -1);
+	std::vector<int> queue;
+	for (int k = 0; k < m; k++)
+		if (won[order[k]])
+		{
+			field.dist[order[k]] = 0;
+			queue.push_back(k);
+		}
+	for (int q = 0; q < (int)queue.size(); q++)
+	{
+		int k = queue[q];
+		for (int e = first[k]; e < first[k + 1]; e++)
+		{
+			int from = pred[e] / 4; // position in order of the predecessor
+			int u = order[from];
+			if (field.dist[u] != -1)
+				continue;
+			field.dist[u] = field.dist[order[k]] + 1;
+			field.next[u] = pred[e] % 4;
+			queue.push_back(from);
+		}
+	}
+	field.valid = true;
+	return field;
+}
+
+#endif
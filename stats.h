@@ -0,0 +1,345 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**************************
+ * Level statistics       *
+ **************************/
+
+/* Every finished attempt at a level becomes one record in an append-only
+   log that outlives the session. The game only pushes records into a
+   lock-free queue; a background thread appends them to the log, keeps the
+   per-level aggregates and answers queries on a UNIX socket, one request
+   line per connection:
+       all          every level, as JSON
+       level <n>    level n (1-based), as JSON */
+
+enum { ATTEMPT_SOLVED = 0, ATTEMPT_FELL = 1, ATTEMPT_RESET = 2 };
+
+// log record, host byte order
+struct stats_record {
+	unsigned short level; // 0-based
+	unsigned char outcome; // ATTEMPT_*
+	unsigned char reserved;
+	unsigned moves;
+	unsigned milliseconds; // from the start of the attempt to its end
+	unsigned time; // end of the attempt, seconds since the epoch
+};
+static_assert(sizeof(stats_record) == 16, "stats_record packs into 16 bytes");
+
+const char stats_magic[8] = { 'B', 'L', 'X', 'S', 'T', 'A', 'T', '1' };
+
+/* Single-producer single-consumer ring; neither side ever blocks */
+template <class T, size_t capacity> class spsc_queue {
+	public:
+		spsc_queue()
+		{
+			head = 0;
+			tail = 0;
+		}
+
+		// producer only; false when full
+		bool push(const T &item)
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) == capacity)
+				return false;
+			items[t % capacity] = item;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer only; false when empty
+		bool pop(T &item)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+				return false;
+			item = items[h % capacity];
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		std::atomic<size_t> head;
+		char pad[64]; // producer and consumer indices on separate cache lines
+		std::atomic<size_t> tail;
+		T items[capacity];
+};
+
+class stats_service {
+	public:
+		stats_service()
+		{
+			log = NULL;
+			listener = -1;
+			running = false;
+			dropped = 0;
+		}
+
+		~stats_service()
+		{
+			stop();
+		}
+
+		/* Read back the log, open it for appending and start serving queries.
+		   Either part is skipped with a message when its path is unusable. */
+		void start(const std::string &log_path, const std::string &socket)
+		{
+			if (running)
+				return;
+			open_log(log_path);
+			listen_on(socket);
+			running = true;
+			flusher = std::thread(&stats_service::run, this);
+		}
+
+		// called by the game; drops the record rather than wait when the queue is full
+		void record(const stats_record &r)
+		{
+			if (!running || !queue.push(r))
+				dropped++;
+		}
+
+		// write out what is queued and close the log and the socket
+		void stop()
+		{
+			if (!running)
+				return;
+			running = false;
+			flusher.join();
+			if (log)
+				fclose(log);
+			log = NULL;
+			if (listener != -1)
+			{
+				close(listener);
+				unlink(socket_path.c_str());
+			}
+			listener = -1;
+			if (dropped > 0)
+				fprintf(stderr, "stats: %lld records dropped, the queue was full\n", (long long)dropped);
+		}
+
+	private:
+		struct level_stats {
+			long long attempts, solved, falls, resets;
+			std::vector<unsigned> moves, milliseconds; // of the solved attempts
+
+			level_stats()
+			{
+				attempts = solved = falls = resets = 0;
+			}
+		};
+
+		spsc_queue<stats_record, 4096> queue;
+		std::map<int, level_stats> levels; // background thread only, once started
+		FILE *log;
+		int listener;
+		std::string socket_path;
+		std::thread flusher;
+		std::atomic<bool> running;
+		std::atomic<long long> dropped;
+
+		void add(const stats_record &r)
+		{
+			level_stats &l = levels[r.level];
+			l.attempts++;
+			if (r.outcome == ATTEMPT_SOLVED)
+			{
+				l.solved++;
+				l.moves.push_back(r.moves);
+				l.milliseconds.push_back(r.milliseconds);
+			}
+			else if (r.outcome == ATTEMPT_FELL)
+				l.falls++;
+			else
+				l.resets++;
+		}
+
+		void open_log(const std::string &path)
+		{
+			long valid = sizeof(stats_magic);
+			FILE *f = fopen(path.c_str(), "rb");
+			if (f)
+			{
+				char magic[sizeof(stats_magic)];
+				size_t n = fread(magic, 1, sizeof(magic), f);
+				if (n == 0) // empty: start it over
+				{
+					fclose(f);
+					f = NULL;
+				}
+				else if (n != sizeof(magic) || memcmp(magic, stats_magic, sizeof(magic)) != 0)
+				{
+					fclose(f);
+					fprintf(stderr, "stats: %s is not a stats log, not recording\n", path.c_str());
+					return;
+				}
+			}
+			if (f)
+			{
+				stats_record r;
+				while (fread(&r, sizeof(r), 1, f) == 1)
+				{
+					add(r);
+					valid += sizeof(r);
+				}
+				fclose(f);
+				if (truncate(path.c_str(), valid) != 0) // drop a record cut short by a crash
+				{
+					fprintf(stderr, "stats: cannot truncate %s to its last whole record, not recording\n", path.c_str());
+					return;
+				}
+			}
+			log = fopen(path.c_str(), "ab");
+			if (!log)
+				fprintf(stderr, "stats: cannot write %s, not recording\n", path.c_str());
+			else if (!f)
+				fwrite(stats_magic, 1, sizeof(stats_magic), log);
+		}
+
+		void listen_on(const std::string &path)
+		{
+			sockaddr_un address;
+			memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			if (path.size() >= sizeof(address.sun_path))
+				return;
+			strcpy(address.sun_path, path.c_str());
+			unlink(path.c_str()); // left behind by a session that did not stop cleanly
+			listener = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (listener == -1 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 8) != 0)
+			{
+				fprintf(stderr, "stats: cannot listen on %s, queries disabled\n", path.c_str());
+				if (listener != -1)
+					close(listener);
+				listener = -1;
+				return;
+			}
+			socket_path = path;
+		}
+
+		void run()
+		{
+			while (true)
+			{
+				bool stopping = !running;
+				stats_record r;
+				bool wrote = false;
+				while (queue.pop(r))
+				{
+					add(r);
+					if (log)
+						wrote = fwrite(&r, sizeof(r), 1, log) == 1;
+				}
+				if (wrote)
+					fflush(log);
+				if (stopping)
+					break;
+
+				// wait for a query, waking up now and then for new records
+				pollfd p = { listener, POLLIN, 0 };
+				if (listener == -1)
+					std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				else if (poll(&p, 1, 20) > 0)
+				{
+					int client = accept(listener, NULL, NULL);
+					if (client != -1)
+					{
+						serve(client);
+						close(client);
+					}
+				}
+			}
+		}
+
+		void serve(int client)
+		{
+			char request[64];
+			int size = 0;
+			pollfd p = { client, POLLIN, 0 };
+			while (size < (int)sizeof(request) - 1 && poll(&p, 1, 100) > 0)
+			{
+				ssize_t n = read(client, request + size, sizeof(request) - 1 - size);
+				if (n <= 0)
+					break;
+				size += n;
+				if (memchr(request, '\n', size))
+					break;
+			}
+			request[size] = 0;
+
+			int level = 0;
+			std::string response;
+			if (sscanf(request, "level %d", &level) == 1)
+				response = levels.count(level - 1) ? report(level - 1) + "\n" : "{ \"error\": \"no attempts at this level\" }\n";
+			else
+				response = report_all();
+
+			int flags = 0;
+#ifdef MSG_NOSIGNAL
+			flags = MSG_NOSIGNAL; // a client that hung up must not kill the game
+#endif
+			for (size_t sent = 0; sent < response.size(); )
+			{
+				ssize_t n = send(client, response.data() + sent, response.size() - sent, flags);
+				if (n <= 0)
+					break;
+				sent += n;
+			}
+		}
+
+		// p50, p90 and p99 of values as a JSON object
+		static std::string percentiles(std::vector<unsigned> values, double scale)
+		{
+			std::ostringstream out;
+			if (values.empty())
+				return "null";
+			std::sort(values.begin(), values.end());
+			out << "{ \"p50\": " << values[values.size()*50/100]*scale
+				<< ", \"p90\": " << values[values.size()*90/100]*scale
+				<< ", \"p99\": " << values[values.size()*99/100]*scale << " }";
+			return out.str();
+		}
+
+		std::string report(int level)
+		{
+			const level_stats &l = levels[level];
+			std::ostringstream out;
+			out << "{ \"level\": " << level + 1
+				<< ", \"attempts\": " << l.attempts
+				<< ", \"solved\": " << l.solved
+				<< ", \"falls\": " << l.falls
+				<< ", \"resets\": " << l.resets
+				<< ", \"moves\": " << percentiles(l.moves, 1)
+				<< ", \"seconds_to_solve\": " << percentiles(l.milliseconds, 0.001) << " }";
+			return out.str();
+		}
+
+		std::string report_all()
+		{
+			std::string out = "{\n  \"levels\": [\n";
+			for (std::map<int, level_stats>::iterator it = levels.begin(); it != levels.end(); ++it)
+				out += "    " + report(it->first) + (std::next(it) != levels.end() ? ",\n" : "\n");
+			return out + "  ]\n}\n";
+		}
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "logic.h"
+#include "solver.h"
+#include "levels.h"
+#include "levelfile.h"
+#include "jobs.h"
+#include "replay.h"
+
+using namespace std;
+
+/* Replay verifier: checks submitted solutions by playing them headlessly.
+
+       verify [--levels levels.pack] [submissions.txt]
+
+   Reads one submission per line from the file, or stdin: the level (1-based)
+   and its moves as L, R, U and D, e.g. "1 RRDRRRD". Blank lines and lines
+   starting with ';' are skipped. Prints one line per submission, in order:
+       <line> legal|illegal won|lost|unfinished <moves played>
+   A submission is illegal when it names no level, has other characters in
+   its moves, or keeps moving after the level was won or lost. */
+
+const int submissions_per_job = 4096;
+
+job_system jobs;
+
+struct submission {
+	int line;
+	int level; // 0-based, -1 = not a level
+	const char *moves;
+	int size;
+};
+
+// the level number and moves of one input line; false for a line to skip
+bool parse_submission(const char *p, const char *end, int num_levels, submission &s)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	while (end > p && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	if (p == end || *p == ';')
+		return false;
+	int level = 0;
+	const char *digits = p;
+	for (; p < end && *p >= '0' && *p <= '9' && level <= num_levels; p++)
+		level = level*10 + (*p - '0');
+	s.level = p > digits && level >= 1 && level <= num_levels ? level - 1 : -1;
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	s.moves = p;
+	s.size = end - p;
+	return true;
+}
+
+// moves as MOVE_*; false on any other character
+bool decode_moves(const submission &s, vector<unsigned char> &moves)
+{
+	moves.resize(s.size);
+	for (int k = 0; k < s.size; k++)
+	{
+		switch (s.moves[k])
+		{
+			case 'L': case 'l': moves[k] = MOVE_LEFT; break;
+			case 'R': case 'r': moves[k] = MOVE_RIGHT; break;
+			case 'U': case 'u': moves[k] = MOVE_UP; break;
+			case 'D': case 'd': moves[k] = MOVE_DOWN; break;
+			default: return false;
+		}
+	}
+	return true;
+}
+
+const char *outcome_name(int outcome)
+{
+	return outcome == GAME_WON ? "won" : outcome == GAME_LOST ? "lost" : "unfinished";
+}
+
+int main (int argc, char** argv)
+{
+	string level_pack = "levels.pack", input;
+	bool pack_given = false;
+	for (int a = 1; a < argc; a++)
+	{
+		string arg = argv[a];
+		if (arg == "--levels" && a + 1 < argc)
+		{
+			level_pack = argv[++a];
+			pack_given = true;
+		}
+		else
+			input = arg;
+	}
+
+	vector<level_def> levels;
+	if (!read_pack(level_pack.c_str(), levels))
+	{
+		if (pack_given)
+			cerr << "verify: " << level_pack << " is not a level pack, verifying against the built-in levels" << endl;
+		for (int k = 0; k < max_maps; k++)
+			levels.push_back(builtin_level(k));
+	}
+
+	vector<char> text;
+	if (input.empty())
+	{
+		char chunk[65536];
+		size_t n;
+		while ((n = fread(chunk, 1, sizeof(chunk), stdin)) > 0)
+			text.insert(text.end(), chunk, chunk + n);
+	}
+	else if (!read_text_file(input, text))
+	{
+		cerr << "verify: cannot read " << input << endl;
+		return 2;
+	}
+
+	auto start = chrono::steady_clock::now();
+	vector<submission> submissions;
+	vector<bool> used(levels.size(), false);
+	const char *p = text.data(), *end = text.data() + text.size();
+	for (int line = 1; p < end; line++)
+	{
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		submission s;
+		s.line = line;
+		if (parse_submission(p, eol, levels.size(), s))
+		{
+			submissions.push_back(s);
+			if (s.level != -1)
+				used[s.level] = true;
+		}
+		p = eol + 1;
+	}
+
+	jobs.start();
+
+	// a table for every level played, built side by side
+	vector<unique_ptr<replay_table>> tables(levels.size());
+	atomic<int> pending(0);
+	for (int k = 0; k < levels.size(); k++)
+		if (used[k])
+		{
+			pending++;
+			jobs.run([&, k]() {
+				tables[k].reset(new replay_table(build_replay_table(load_level(levels[k]))));
+				pending--;
+			});
+		}
+	jobs.help_until([&]() { return pending == 0; });
+
+	// then the submissions, in chunks that each write their own lines
+	int chunks = (submissions.size() + submissions_per_job - 1) / submissions_per_job;
+	vector<string> output(chunks);
+	vector<long long> legal(chunks, 0), won(chunks, 0);
+	pending = chunks;
+	for (int c = 0; c < chunks; c++)
+		jobs.run([&, c]() {
+			vector<unsigned char> moves;
+			char line[64];
+			int last = min((int)submissions.size(), (c + 1)*submissions_per_job);
+			for (int k = c*submissions_per_job; k < last; k++)
+			{
+				const submission &s = submissions[k];
+				replay_result r = { false, GAME_IN_PROGRESS, 0 };
+				if (s.level != -1 && decode_moves(s, moves))
+					r = replay(*tables[s.level], moves.data(), moves.size());
+				legal[c] += r.legal;
+				won[c] += r.legal && r.outcome == GAME_WON;
+				snprintf(line, sizeof(line), "%d %s %s %d\n", s.line, r.legal ? "legal" : "illegal", outcome_name(r.outcome), r.moves);
+				output[c] += line;
+			}
+			pending--;
+		});
+	jobs.help_until([&]() { return pending == 0; });
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	jobs.stop();
+
+	long long total_legal = 0, total_won = 0;
+	for (int c = 0; c < chunks; c++)
+	{
+		fwrite(output[c].data(), 1, output[c].size(), stdout);
+		total_legal += legal[c];
+		total_won += won[c];
+	}
+	cerr << "verify: " << submissions.size() << " submissions, " << total_legal << " legal, " << total_won << " won, in "
+		<< seconds << " s (" << (long long)(submissions.size() / max(seconds, 1e-9)) << " per second)" << endl;
+	return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include "logic.h"
+
+/**************************
+ * Zobrist hashing        *
+ **************************/
+
+/* 64-bit hashes of boards and game states as the XOR of one key per
+   feature, so a change of one feature updates a hash with one XOR. Keys
+   come from splitmix64 over the feature instead of a stored random table:
+   the same on every run and machine, whatever the size of the map. */
+
+enum {
+	ZOBRIST_SIZE = 1, // rows, cols
+	ZOBRIST_TILE = 2, // cell, tile type
+	ZOBRIST_BRIDGE = 3, // bridge cell, its bit in pose::bridges
+	ZOBRIST_TOGGLE = 4, // switch cell, bridge bit it flips
+	ZOBRIST_POSE = 5, // cell of cube one, state
+	ZOBRIST_SHOWN = 6, // bridge bit, set in pose::bridges
+	ZOBRIST_HIDDEN = 7 // cell of a tile not shown: an open bridge, a broken fragile tile
+};
+
+inline unsigned long long splitmix64(unsigned long long x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+inline unsigned long long zobrist(int feature, unsigned a, unsigned b)
+{
+	return splitmix64((unsigned long long)feature << 56 ^ (unsigned long long)a << 24 ^ b);
+}
+
+// the shown bridges of a pose
+inline unsigned long long zobrist_bridges(unsigned bridges)
+{
+	unsigned long long h = 0;
+	for (int b = 0; b < 32 && bridges >> b; b++)
+		if ((bridges >> b) & 1)
+			h ^= zobrist(ZOBRIST_SHOWN, b, 0);
+	return h;
+}
+
+// where the cuboid is and which bridges are shown
+inline unsigned long long zobrist_pose(const board &b, const pose &p)
+{
+	return zobrist(ZOBRIST_POSE, p.i*b.cols + p.j, p.state) ^ zobrist_bridges(p.bridges);
+}
+
+// the tiles, the switch table and the start
+inline unsigned long long zobrist_board(const board &b)
+{
+	unsigned long long h = zobrist(ZOBRIST_SIZE, b.rows, b.cols);
+	for (int c = 0; c < b.rows*b.cols; c++)
+	{
+		if (b.type[c] != TILE_EMPTY)
+			h ^= zobrist(ZOBRIST_TILE, c, b.type[c]);
+		if (b.bridge_bit[c] != -1)
+			h ^= zobrist(ZOBRIST_BRIDGE, c, b.bridge_bit[c]);
+		for (int bit = 0; bit < 32 && b.toggles[c] >> bit; bit++)
+			if ((b.toggles[c] >> bit) & 1)
+				h ^= zobrist(ZOBRIST_TOGGLE, c, bit);
+	}
+	return h ^ zobrist_pose(b, b.start);
+}
+
+#endif